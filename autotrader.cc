@@ -22,6 +22,27 @@
 #include <string>
 #include <unordered_set>
 #include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <boost/asio/io_context.hpp>
 #include <ready_trader_go/logging.h>
@@ -37,483 +58,2686 @@ constexpr int POSITION_LIMIT = 100;
 constexpr int TICK_SIZE_IN_CENTS = 100;
 constexpr int MIN_BID_NEARST_TICK = (MINIMUM_BID + TICK_SIZE_IN_CENTS) / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
 constexpr int MAX_ASK_NEAREST_TICK = MAXIMUM_ASK / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
+constexpr std::size_t LADDER_LEVELS = 3; //passive ETF quotes per side, the signal order takes one more slot
+constexpr int LADDER_EDGE_TICKS = 1; //ticks between fair value and the first passive level
+constexpr int HEDGE_BATCH_WINDOW_MS = 5; //fills arriving within this window are netted into one hedge (0 = hedge every fill)
+constexpr std::array<double, SIGNAL_HORIZONS> SIGNAL_HALF_LIVES = {4, 16, 64, 256}; //in book updates
+constexpr std::size_t SIGNAL_HORIZON = 1; //horizon the entry decision uses
+constexpr std::size_t SIGNAL_FAIR_HORIZON = 3; //horizon whose mean spread is added to fair value
+constexpr unsigned long SIGNAL_WARMUP = 32; //updates before the decision horizon is trusted
+constexpr double SIGNAL_THRESHOLD = 1.0; //z-score needed to call one instrument much greater
+constexpr double SIGNAL_EXIT_THRESHOLD = 0.25; //and the z-score it has to fall back inside before the call is dropped
+constexpr unsigned long TARGET_POSITION_LOTS = 30; //ETF position taken while one instrument is much greater
+constexpr double FLOW_SKEW_TICKS = 1.0; //fair value moves this many ticks at full buy (or sell) trade imbalance in the future
+constexpr signed long MAX_LOSS_IN_CENTS = 2000000; //stop quoting once marked-to-market PnL falls below -MAX_LOSS
+constexpr int FLIGHT_ERROR_DUMP_INTERVAL_MS = 10000; //errors after the first only dump the flight recorder this often
+constexpr const char* CHECKPOINT_FILE = "autotrader.checkpoint";
+constexpr int CHECKPOINT_INTERVAL_MS = 250;
+constexpr std::int64_t CHECKPOINT_MAX_AGE_MS = 30000; //older snapshots are from an earlier match, not a restart of this one
+constexpr int TIMER_TICK_MS = 10; //timer wheel resolution
+constexpr int QUOTE_MAX_AGE_MS = 3000; //GFD quotes are pulled once the feed has been quiet this long, the next book puts them back
+constexpr int HEDGE_DEADLINE_MS = 1000; //a hedge not answered by now is re-sent, and forgotten after twice this
+constexpr std::array<int, MARKOUT_HORIZONS> MARKOUT_HORIZONS_MS = {100, 1000, 10000}; //ETF mid sampled this long after each fill
+constexpr signed long UNHEDGED_LIMIT_LOTS = 10; //exchange rule: no more than this many lots unhedged...
+constexpr int UNHEDGED_GRACE_MS = 45000; //...for 60s, so the watchdog forces a hedge well before then
+constexpr int UNHEDGED_RETRY_MS = 1000; //and keeps forcing one this often until we are back inside the limit
+constexpr unsigned long WARMUP_ROUNDS = 64; //synthetic FUTURE+ETF book/tick rounds run before trading
+constexpr unsigned long WARMUP_PRICE = 100000; //synthetic future price in cents
+constexpr bool ENABLE_PERF_COUNTERS = false; //count cycles/instructions/cache and branch misses per handler
+constexpr bool ENABLE_SHADOW_TRADER = false; //paper trade a copy of the strategy off the live feed on its own thread
+constexpr int SHADOW_CPU = -1; //core the shadow thread is pinned to, -1 = not pinned
+constexpr const char* METRICS_FILE = "autotrader.prom"; //rewritten once a second in Prometheus text format
+constexpr const char* SHADOW_METRICS_FILE = "autotrader_shadow.prom";
+constexpr bool ENABLE_JOURNAL = false; //record the live feed, the sessions PGO builds and benchmarks replay
+constexpr const char* JOURNAL_PREFIX = "autotrader_session_"; //followed by the start time in seconds and .journal
+constexpr int JOURNAL_IDLE_SLEEP_MS = 1; //the writer is not latency sensitive, so it sleeps rather than spins
+constexpr double PAPER_MAKER_FEE = -0.0001; //fraction of traded value, negative = rebate
+constexpr double PAPER_TAKER_FEE = 0.0002;
+constexpr std::uint64_t CHECKPOINT_MAGIC = 0x52544743484b5035; //"RTGCHKP5", bump if Checkpoint changes
+
+static_assert(sizeof(FlightRecord) == 48, "flight records are written to disk as fixed size binary");
+
+static_assert(LADDER_LEVELS < TOP_LEVEL_COUNT, "ladder and signal order must fit in the quote slots");
+
+static_assert(std::is_trivially_copyable<Checkpoint>::value, "checkpoints are copied straight into the mapped file");
 
-AutoTrader::AutoTrader(boost::asio::io_context& context) : BaseAutoTrader(context)
+static_assert((TIMER_WHEEL_SLOTS & (TIMER_WHEEL_SLOTS - 1)) == 0, "timer wheel slots must be a power of two");
+
+//Steady clock timestamp used for order round trips
+static std::int64_t nowNanoseconds()
 {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-//Custom log function
-void AutoTrader::positionLog()
+//Wall clock, for what has to be compared across processes
+static std::int64_t wallNanoseconds()
 {
-    RLOG(LG_AT, LogLevel::LL_INFO) << "=---------------------------------=";
-    RLOG(LG_AT, LogLevel::LL_INFO) << "ETF Pos: " << ETF_Pos << std::endl;
-    RLOG(LG_AT, LogLevel::LL_INFO) << "Future Pos: " << FTR_Pos << std::endl;
-    RLOG(LG_AT, LogLevel::LL_INFO) << "ETF Bids: " << std::endl;
-    for(int i = 0; i < ETF_bid_arr.size(); i++) { RLOG(LG_AT, LogLevel::LL_INFO) << "| " << ETF_bid_arr[i]; }
-    RLOG(LG_AT, LogLevel::LL_INFO) << "ETF Asks: " << std::endl;
-    for(int i = 0; i < ETF_ask_arr.size(); i++) { RLOG(LG_AT, LogLevel::LL_INFO) << "| " << ETF_ask_arr[i]; }
-    RLOG(LG_AT, LogLevel::LL_INFO) << "Future Bids: " << std::endl;
-    for(int i = 0; i < FTR_bid_arr.size(); i++) { RLOG(LG_AT, LogLevel::LL_INFO) << "| " << FTR_bid_arr[i]; }
-    RLOG(LG_AT, LogLevel::LL_INFO) << "Future Asks: " << std::endl;
-    for(int i = 0; i < FTR_ask_arr.size(); i++) { RLOG(LG_AT, LogLevel::LL_INFO) << "| " << FTR_ask_arr[i]; }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
-/* Function to check if midpoint prices are "far enough" subjectively to trade */
-void AutoTrader::deterMineOrderStatus(std::queue<unsigned long> DIFF_recent_mp_prices)
+TraderCore::TraderCore(boost::asio::io_context& context, TraderMode mode) : BaseAutoTrader(context), mMode(mode),
+                                                                             mHedgeTimer(context), mWheelTimer(context),
+                                                                             mWheelStart(std::chrono::steady_clock::now()),
+                                                                             mSignals(SIGNAL_HALF_LIVES)
 {
-    unsigned int last = DIFF_recent_mp_prices.size()-1;
-    //find mean of difference of midpoint prices (ETF-FTR) of last n-1 entries
-    unsigned long avgDif = 0;
-    for(int i = 1; i < DIFF_recent_mp_prices.size();i++)
+    if (ENABLE_PERF_COUNTERS)
     {
-        avgDif+=(DIFF_recent_mp_prices[i]);
+        mPerf.open();
     }
-    avgDif/=(DIFF_recent_mp_price.size() - 1);
-
-    //find std deviation of difference of midpoint prices of last n-1 entries
-    unsigned long stdDevDif = 0;
-    for(int i = 1; i < DIFF_recent_mp_prices.size(); i++)
+    if (mMode != TraderMode::LIVE)
     {
-        stdDevDif += std::pow((avgDif - DIFF_recent_mp_prices[i]),2);
+        mFlight.setPrefix((mMode == TraderMode::SHADOW) ? "autotrader_shadow_flight_" : "autotrader_benchmark_flight_");
     }
-    stdDevDif = std::pow(stdDevDif/=(DIFF_recent_mp_price.size() - 1), 1/2);
-
-    //check if the differences are extreme enough
-    if(DIFF_recent_mp_prices[last] > avgDif + 1*(stdDevDif))
-    {
-        ETF_Much_Greater = true;
-        FTR_Much_Greater = false;
-    } else if(DIFF_recent_mp_prices[last] < avgDif - 1*(stdDevDif))
+    //shadow and benchmark traders start flat every time and must not touch the live trader's checkpoint
+    if (mMode == TraderMode::LIVE)
     {
-        ETF_Much_Greater = false;
-        FTR_Much_Greater = true;
-    } else{
-        ETF_Much_Greater = false;
-        FTR_Much_Greater = false;
+        openCheckpoint();
     }
 }
 
+//Out of line so the shadow trader, only declared in the header, can be stopped here
+TraderCore::~TraderCore() = default;
 
-//Misc
-void AutoTrader::DisconnectHandler()
+//Warms up and starts the timers, called by the host once its handlers exist since warm-up goes through them
+void TraderCore::start()
 {
-    BaseAutoTrader::DisconnectHandler();
-    RLOG(LG_AT, LogLevel::LL_INFO) << "execution connection lost";
+    warmUp();
+    mMetrics.set(MetricGauge::ETF_POSITION, ETF_Pos);
+    mMetrics.set(MetricGauge::FUTURE_POSITION, FTR_Pos);
+    if (mMode != TraderMode::BENCHMARK)
+    {
+        mMetrics.start((mMode == TraderMode::LIVE) ? METRICS_FILE : SHADOW_METRICS_FILE);
+    }
+    scheduleCheckpoint();
+    mWheelTimer.expires_at(mWheelStart);
+    scheduleTimerTick();
+    startJournal();
 }
 
-//Error logger
-void AutoTrader::ErrorMessageHandler(unsigned long clientOrderId,
-                                     const std::string& errorMessage)
+//Maps the checkpoint file and, if it holds a complete snapshot from an earlier run, picks up where that left off
+void TraderCore::openCheckpoint()
 {
-    RLOG(LG_AT, LogLevel::LL_INFO) << "error with order " << clientOrderId << ": " << errorMessage;
-    if (clientOrderId != 0 && ((mAsks.count(clientOrderId) == 1) || (mBids.count(clientOrderId) == 1)))
+    int fd = ::open(CHECKPOINT_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd == -1 || ::ftruncate(fd, sizeof(Checkpoint)) == -1)
+    {
+        RLOG(LG_AT, LogLevel::LL_INFO) << "checkpoint: could not open " << CHECKPOINT_FILE << ", running without one";
+        if (fd != -1)
+        {
+            ::close(fd);
+        }
+        return;
+    }
+
+    void* mapping = ::mmap(nullptr, sizeof(Checkpoint), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        RLOG(LG_AT, LogLevel::LL_INFO) << "checkpoint: could not map " << CHECKPOINT_FILE << ", running without one";
+        return;
+    }
+    mCheckpoint = static_cast<Checkpoint*>(mapping);
+
+    //an odd version means we died half way through writing it, an old one that it was left by an earlier match (the
+    //warm-up overwrites it either way)
+    bool complete = mCheckpoint->magic == CHECKPOINT_MAGIC && mCheckpoint->version % 2 == 0;
+    std::int64_t age = (wallNanoseconds() - mCheckpoint->savedAt) / 1000000;
+    if (complete && (age < 0 || age > CHECKPOINT_MAX_AGE_MS))
     {
-        OrderStatusMessageHandler(clientOrderId, 0, 0, 0);
+        RLOG(LG_AT, LogLevel::LL_INFO) << "checkpoint: ignoring a snapshot " << age / 1000 << "s old, starting flat";
+    }
+    else if (complete)
+    {
+        restoreCheckpoint(*mCheckpoint);
+        mReconcilePending = true;
+        RLOG(LG_AT, LogLevel::LL_INFO) << "checkpoint: restored ETF Pos " << ETF_Pos << ", Future Pos " << FTR_Pos
+                                       << ", " << mSignals.count() << " signal updates, next order id " << mNextMessageId;
     }
 }
 
-//Hedge Function Logger
-void AutoTrader::HedgeFilledMessageHandler(unsigned long clientOrderId,
-                                           unsigned long price,
-                                           unsigned long volume)
+//Copies the state that survives a restart
+void TraderCore::captureState(Checkpoint& checkpoint) const
 {
-    RLOG(LG_AT, LogLevel::LL_INFO) << "hedge order " << clientOrderId << " filled for " << volume
-                                   << " lots at $" << price << " average price in cents";
+    checkpoint.nextMessageId = mNextMessageId;
+    checkpoint.etfPosition = ETF_Pos;
+    checkpoint.futurePosition = FTR_Pos;
+    checkpoint.slotPositions = mSlotPositions;
+    checkpoint.pnl = mPnL;
+    checkpoint.signals = mSignals;
+    checkpoint.quotes = mQuotes;
 }
 
-//Called 4 times a second by exchange (2 time Instrument = ETF, 2 times Instrument = FUTURE)
-void AutoTrader::OrderBookMessageHandler(Instrument instrument,
-                                         unsigned long sequenceNumber,
-                                         const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
-                                         const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
-                                         const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
-                                         const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes)
+//Copies the strategy state into the mapped file, the page cache keeps it if the process dies
+void TraderCore::saveCheckpoint()
 {
-    RLOG(LG_AT, LogLevel::LL_INFO) << "order book received for " << instrument << " instrument"
-                                   << ": ask prices: " << askPrices[0]
-                                   << "; ask volumes: " << askVolumes[0]
-                                   << "; bid prices: " << bidPrices[0]
-                                   << "; bid volumes: " << bidVolumes[0];  
-
-    if (instrument == Instrument::ETF)
+    if (mCheckpoint == nullptr)
     {
-        //retrieving data
-        ETF_ask_arr = askPrices;
-        ETF_bid_arr = bidPrices;
-        ETF_bestAsk = askPrices[0];
-        ETF_bestBid = bidPrices[0];
-        //storing midprice
-        ETF_midprice = (ETF_bestAsk + ETF_bestBid) / 2;
+        return;
+    }
 
-        if(ETF_recent_mp_prices.size() <= 31) //rolling avg for thirty
+    std::uint64_t version = mCheckpoint->version + 1;
+    mCheckpoint->version = version;
+    std::atomic_thread_fence(std::memory_order_release);
+    mCheckpoint->magic = CHECKPOINT_MAGIC;
+    mCheckpoint->savedAt = wallNanoseconds();
+    captureState(*mCheckpoint);
+    std::atomic_thread_fence(std::memory_order_release);
+    mCheckpoint->version = version + 1;
+}
+
+void TraderCore::restoreCheckpoint(const Checkpoint& checkpoint)
+{
+    mNextMessageId = checkpoint.nextMessageId;
+    ETF_Pos = checkpoint.etfPosition;
+    FTR_Pos = checkpoint.futurePosition;
+    mSlotPositions = checkpoint.slotPositions;
+    mPnL = checkpoint.pnl;
+    mSignals = checkpoint.signals;
+    mQuotes = checkpoint.quotes;
+    //timer handles belong to the wheel of the process that wrote them
+    for (QuoteManager& quotes : mQuotes)
+    {
+        for (std::size_t i = 0; i < TOP_LEVEL_COUNT; i++)
         {
-            ETF_recent_mp_prices.push_back(ETF_midprice);   
+            quotes.asks[i].expiry = 0;
+            quotes.bids[i].expiry = 0;
         }
-        else
+    }
+    //hedges that were in flight are not restored, anything they left unhedged is picked up by the next hedge
+}
+
+//Cancels every quote the checkpoint thought was live, the exchange answers with a status (or an error if it was
+//already gone) and the usual handlers clear the quote either way
+void TraderCore::reconcileRestoredOrders()
+{
+    mReconcilePending = false;
+    for (std::size_t slot = 0; slot < STRATEGY_SLOTS; slot++)
+    {
+        for (std::size_t i = 0; i < TOP_LEVEL_COUNT; i++)
         {
-            ETF_recent_mp_prices.pop();
-            ETF_recent_mp_prices.push_back(ETF_midprice);
+            updateQuote(slot, Side::SELL, i, 0, 0);
+            updateQuote(slot, Side::BUY, i, 0, 0);
         }
+    }
+    scheduleHedge(0);
+    checkExposure();
+}
 
-        if(ETF_midprice != 0 && FTR_midprice != 0) //if game has started
+//Runs the handlers over synthetic books with sending disabled, so the first real message finds containers already
+//allocated, state pages faulted in and the branches trained. Everything the run touched is put back afterwards.
+void TraderCore::warmUp()
+{
+    RLOG(LG_AT, LogLevel::LL_INFO) << "warm-up: start";
+    Checkpoint saved;
+    captureState(saved);
+    //restored orders are reconciled on the first real book, not on a synthetic one while nothing can be sent
+    bool reconcilePending = mReconcilePending;
+    mReconcilePending = false;
+
+    mFlight.touch();
+
+    mOffline = true;
+    std::array<unsigned long, TOP_LEVEL_COUNT> askPrices{};
+    std::array<unsigned long, TOP_LEVEL_COUNT> bidPrices{};
+    std::array<unsigned long, TOP_LEVEL_COUNT> volumes{};
+    volumes.fill(5 * LOT_SIZE);
+    for (unsigned long round = 0; round < WARMUP_ROUNDS; round++)
+    {
+        //the ETF wanders a few ticks either side of the future so both signals and the flat state all get exercised
+        unsigned long future = WARMUP_PRICE + (round % 7) * TICK_SIZE_IN_CENTS;
+        unsigned long etf = future + ((round / 8) % 5) * TICK_SIZE_IN_CENTS - 2 * TICK_SIZE_IN_CENTS;
+        for (Instrument instrument : {Instrument::FUTURE, Instrument::ETF})
         {
-            //log
-            positionLog();
-            //if theres an even amount of samples, take the difference and add it to sample of differences then check if we should trade
-            if(ETF_recent_mp_prices.size() == FTR_recent_mp_prices.size())
+            unsigned long mid = (instrument == Instrument::ETF) ? etf : future;
+            for (std::size_t i = 0; i < TOP_LEVEL_COUNT; i++)
             {
-                DIFF_recent_mp_prices.push_back(ETF_recent_mp_prices[ETF_recent_mp_prices.size()-1] - FTR_recent_mp_prices[FTR_recent_mp_prices.size()-1]);
-                deterMineOrderStatus(DIFF_recent_mp_prices); //<== determines ETF_Much_Greater/FTR_Much_Greater
+                askPrices[i] = mid + (i + 1) * TICK_SIZE_IN_CENTS;
+                bidPrices[i] = mid - (i + 1) * TICK_SIZE_IN_CENTS;
             }
-            
+            OrderBookMessageHandler(instrument, round, askPrices, volumes, bidPrices, volumes);
+            TradeTicksMessageHandler(instrument, round, askPrices, volumes, bidPrices, volumes);
+        }
 
-            if(ETF_Much_Greater == true && ETF_Pos - std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]) > -100)
+        //fill whatever got quoted and whatever got hedged
+        for (const QuoteManager& quotes : mQuotes)
+        {
+            for (std::size_t i = 0; i < TOP_LEVEL_COUNT; i++)
             {
-                //send a Ask/Sell order at the best bid
-                unsigned long tempID = mAskID;
-                SendInsertOrder(mAskID, Side::SELL, ETF_bestBid, std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_ETF_ask_arr.push_back(ETF_bestBid);
-                my_ETF_ask_ids.push_back(ETF_tempID)
-                my_ETF_ask_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Etf Ask/Sell Placed~~~~~~~~";  
-                positionLog();
-                //send a Buy order at the best ask for FTR
-                unsigned int tempID2 = mAskID;
-                SendHedgeOrder(mAskID, SIDE::BUY, FTR_bestAsk, std::min((unsigned long)LOT_SIZE, FTR_ask_vol_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_FTR_bid_arr.push_back(FTR_bestAsk);
-                my_FTR_ask_ids.push_back(tempID2);
-                my_FTR_bid_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, FTR_ask_vol_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Hedge Bid/Buy Placed~~~~~~~~";  
-                positionLog();
-                
-            } else if(FTR_Much_Greater == true && ETF_Pos + std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]) < 100)
+                for (const LiveQuote* quote : {&quotes.asks[i], &quotes.bids[i]})
+                {
+                    if (quote->id != 0 && round % 3 == 0)
+                    {
+                        unsigned long id = quote->id;
+                        unsigned long volume = quote->volume - quote->filled;
+                        OrderFilledMessageHandler(id, quote->price, volume);
+                        OrderStatusMessageHandler(id, quote->volume, 0, (signed long)volume);
+                    }
+                }
+            }
+        }
+        for (const PendingHedge& hedge : mHedges.pending)
+        {
+            if (hedge.id != 0)
             {
-                 //send an ETF Bid/Buy order at the best ask
-                unsigned long tempID = mAskID;
-                SendInsertOrder(mAskID, Side::BUY, ETF_bestAsk, std::min((unsigned long)LOT_SIZE, ETF_ask_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_ETF_bid_arr.push_back(ETF_bestAsk);
-                my_ETF_bid_ids.push_back(tempID);
-                my_etf_bid_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, ETF_ask_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Etf Ask/Sell Placed~~~~~~~~";  
-                positionLog();
-                //send a Ask/Sell order at the best bid for FTR
-                unsigned long tempID2 = mAskID;
-                SendHedgeOrder(mAskID, SIDE::SELL, FTR_bestBid, std::min((unsigned long)LOT_SIZE, FTR_bid_vol_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_FTR_ask_arr.push_back(FTR_bestBid);
-                my_FTR_ask_ids.push_back(tempID2);
-                my_FTR_ask_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, FTR_bid_vol_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Hedge Bid/Buy Placed~~~~~~~~";  
-                positionLog();
+                HedgeFilledMessageHandler(hedge.id, future, std::labs(hedge.lots));
             }
         }
     }
-//=------------------------------------------------------------------------------------------------------------------------------------=
-    if (instrument == Instrument::FUTURE)
-    {
-        FTR_ask_arr = askPrices;
-        FTR_bid_arr = bidPrices;
-        FTR_bestAsk = askPrices[0];
-        FTR_bestBid = bidPrices[0];
-        //storing midprice
-        FTR_midprice = (FTR_bestAsk + FTR_bestBid) / 2;
+    mOffline = false;
 
-        if(FTR_recent_mp_prices.size() <= 31) //rolling avg for thirty
-        {
-            FTR_recent_mp_prices.push_back(FTR_midprice);   
-        }
-        else
-        {
-            FTR_recent_mp_prices.pop();
-            FTR_recent_mp_prices.push_back(FTR_midprice);
-        }
+    //back to how we found it
+    mTimers.clear();
+    mHedges = HedgeManager();
+    mWatchdog = ExposureWatchdog();
+    mMarkouts = MarkoutEngine();
+    mLastBook = 0;
+    mOrders = {};
+    mFlight.clear();
+    mPerf.reset();
+    mMetrics.reset();
+    ETF_flow = TradeFlow();
+    FTR_flow = TradeFlow();
+    FTR_flowChanged = false;
+    ETF_bestAsk = ETF_bestBid = ETF_midprice = 0;
+    FTR_bestAsk = FTR_bestBid = FTR_midprice = 0;
+    ETF_ask_arr = ETF_ask_vol_arr = ETF_bid_arr = ETF_bid_vol_arr = {};
+    FTR_ask_arr = FTR_ask_vol_arr = FTR_bid_arr = FTR_bid_vol_arr = {};
+    restoreCheckpoint(saved);
+    mReconcilePending = reconcilePending;
+    saveCheckpoint(); //faults the mapped checkpoint pages in as well
+    RLOG(LG_AT, LogLevel::LL_INFO) << "warm-up: done";
+}
 
-        if(ETF_midprice != 0 && FTR_midprice != 0) //if game has started
-        {
-            //log
-            positionLog();
-            //if theres an even amount of samples, take the difference and add it to sample of differences then check if we should trade
-            if(ETF_recent_mp_prices.size() == FTR_recent_mp_prices.size())
-            {
-                DIFF_recent_mp_prices.push_back(ETF_recent_mp_prices[ETF_recent_mp_prices.size()-1] - FTR_recent_mp_prices[FTR_recent_mp_prices.size()-1]);
-                deterMineOrderStatus(DIFF_recent_mp_prices); //<== determines ETF_Much_Greater/FTR_Much_Greater
-            }
-            
+//Checkpointing is the periodic housekeeping job on the timer wheel
+void TraderCore::scheduleCheckpoint()
+{
+    scheduleTimer(CHECKPOINT_INTERVAL_MS, TimerKind::HOUSEKEEPING, 0);
+}
 
-            if(ETF_Much_Greater == true && ETF_Pos - std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]) > -100)
-            {
-                //send a Ask/Sell order at the best bid
-                unsigned long tempID = mAskID;
-                SendInsertOrder(mAskID, Side::SELL, ETF_bestBid, std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_ETF_ask_arr.push_back(ETF_bestBid);
-                my_ETF_ask_ids.push_back(ETF_tempID)
-                my_ETF_ask_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Etf Ask/Sell Placed~~~~~~~~";  
-                positionLog();
-                //send a Buy order at the best ask for FTR
-                unsigned int tempID2 = mAskID;
-                SendHedgeOrder(mAskID, SIDE::BUY, FTR_bestAsk, std::min((unsigned long)LOT_SIZE, FTR_ask_vol_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_FTR_bid_arr.push_back(FTR_bestAsk);
-                my_FTR_ask_ids.push_back(tempID2);
-                my_FTR_bid_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, FTR_ask_vol_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Hedge Bid/Buy Placed~~~~~~~~";  
-                positionLog();
-                
-            } else if(FTR_Much_Greater == true && ETF_Pos + std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]) < 100)
-            {
-                 //send an ETF Bid/Buy order at the best ask
-                unsigned long tempID = mAskID;
-                SendInsertOrder(mAskID, Side::BUY, ETF_bestAsk, std::min((unsigned long)LOT_SIZE, ETF_ask_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_ETF_bid_arr.push_back(ETF_bestAsk);
-                my_ETF_bid_ids.push_back(tempID);
-                my_etf_bid_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, ETF_ask_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Etf Ask/Sell Placed~~~~~~~~";  
-                positionLog();
-                //send a Ask/Sell order at the best bid for FTR
-                unsigned long tempID2 = mAskID;
-                SendHedgeOrder(mAskID, SIDE::SELL, FTR_bestBid, std::min((unsigned long)LOT_SIZE, FTR_bid_vol_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_FTR_ask_arr.push_back(FTR_bestBid);
-                my_FTR_ask_ids.push_back(tempID2);
-                my_FTR_ask_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, FTR_bid_vol_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Hedge Bid/Buy Placed~~~~~~~~";  
-                positionLog();
-            }
-        }
+FlightRecorder::~FlightRecorder()
+{
+    wait();
+}
+
+//Stores one event, overwriting the oldest once the ring is full
+void FlightRecorder::record(FlightEvent event, unsigned long id, unsigned long a, unsigned long b, unsigned long c)
+{
+    FlightRecord& r = mRecords[mNext % FLIGHT_RECORDER_SIZE];
+    r.time = std::chrono::steady_clock::now().time_since_epoch().count();
+    r.event = event;
+    r.id = id;
+    r.a = a;
+    r.b = b;
+    r.c = c;
+    mNext++;
+}
+
+//Writes every record once so the ring's pages are faulted in before trading
+void FlightRecorder::touch()
+{
+    for (FlightRecord& r : mRecords)
+    {
+        r = FlightRecord();
     }
 }
 
+void FlightRecorder::clear()
+{
+    mNext = 0;
+    mLastDump = 0;
+}
 
+//Dump files are named prefix + number + reason, so traders sharing a directory keep theirs apart
+void FlightRecorder::setPrefix(const std::string& prefix)
+{
+    mPrefix = prefix;
+}
 
-//Order Message Logger
-void AutoTrader::OrderFilledMessageHandler(unsigned long clientOrderId,
-                                           unsigned long price,
-                                           unsigned long volume)
+//Copies the ring oldest first and writes it to disk on a separate thread so the handlers never wait on I/O. Nothing
+//is written within minIntervalMs of the last dump, and the file names go round FLIGHT_DUMP_FILES so the disk cannot
+//fill up with them. A dump still being written is finished first rather than dropped
+void FlightRecorder::dump(const std::string& reason, int minIntervalMs)
 {
-    RLOG(LG_AT, LogLevel::LL_INFO) << "order " << clientOrderId << " filled for " << volume
-                                   << " lots at $" << price << " cents";
-    if (mAsks.count(clientOrderId) == 1)
+    std::int64_t now = nowNanoseconds();
+    if (mLastDump != 0 && now - mLastDump < (std::int64_t)minIntervalMs * 1000000)
     {
-        mPosition -= (long)volume;
-        SendHedgeOrder(mNextMessageId++, Side::BUY, MAX_ASK_NEAREST_TICK, volume);
+        return;
     }
-    else if (mBids.count(clientOrderId) == 1)
+    wait();
+    mLastDump = now;
+
+    std::size_t count = std::min(mNext, FLIGHT_RECORDER_SIZE);
+    std::vector<FlightRecord> records;
+    records.reserve(count);
+    for (std::size_t i = mNext - count; i < mNext; i++)
     {
-        mPosition += (long)volume;
-        SendHedgeOrder(mNextMessageId++, Side::SELL, MIN_BID_NEARST_TICK, volume);
+        records.push_back(mRecords[i % FLIGHT_RECORDER_SIZE]);
     }
+
+    std::string fileName = mPrefix + std::to_string(mDumps++ % FLIGHT_DUMP_FILES) + "_" + reason + ".bin";
+    mWriter = std::thread([fileName, records = std::move(records)]()
+    {
+        std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(FlightRecord));
+    });
+    RLOG(LG_AT, LogLevel::LL_INFO) << "flight recorder: writing " << count << " events to " << fileName;
 }
 
+//Blocks until the last dump is on disk
+void FlightRecorder::wait()
+{
+    if (mWriter.joinable())
+    {
+        mWriter.join();
+    }
+}
 
-//Called when error rn (can use)
-void AutoTrader::OrderStatusMessageHandler(unsigned long clientOrderId,
-                                           unsigned long fillVolume,
-                                           unsigned long remainingVolume,
-                                           signed long fees)
+//Adds one trade ticks message and drops the one that falls out of the window, O(TOP_LEVEL_COUNT)
+void TradeFlow::onTicks(const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
+                        const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
+                        const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
+                        const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes,
+                        unsigned long bestAsk,
+                        unsigned long bestBid)
 {
-    if (remainingVolume == 0)
+    //trades on the ask side were buyers lifting offers, trades on the bid side were sellers hitting bids
+    TradeSample sample;
+    unsigned long highestBuy = 0;
+    unsigned long lowestSell = 0;
+    for (std::size_t i = 0; i < TOP_LEVEL_COUNT; i++)
     {
-        if (clientOrderId == mAskId)
+        sample.buyVolume += askVolumes[i];
+        sample.sellVolume += bidVolumes[i];
+        sample.notional += askPrices[i] * askVolumes[i] + bidPrices[i] * bidVolumes[i];
+        if (askVolumes[i] != 0)
         {
-            mAskId = 0;
+            highestBuy = std::max(highestBuy, askPrices[i]);
         }
-        else if (clientOrderId == mBidId)
+        if (bidVolumes[i] != 0 && (lowestSell == 0 || bidPrices[i] < lowestSell))
         {
-            mBidId = 0;
+            lowestSell = bidPrices[i];
         }
+    }
+
+    //a trade beyond the best price we last saw means someone swept through the top of the book
+    lastTradeThrough = 0;
+    if (bestAsk != 0 && highestBuy > bestAsk)
+    {
+        lastTradeThrough = 1;
+        tradeThroughs++;
+    }
+    else if (bestBid != 0 && lowestSell != 0 && lowestSell < bestBid)
+    {
+        lastTradeThrough = -1;
+        tradeThroughs++;
+    }
+
+    TradeSample& oldest = mSamples[mNext];
+    mBuyVolume += sample.buyVolume - oldest.buyVolume;
+    mSellVolume += sample.sellVolume - oldest.sellVolume;
+    mNotional += sample.notional - oldest.notional;
+    oldest = sample;
+    mNext = (mNext + 1) % TRADE_FLOW_WINDOW;
+}
+
+//Volume weighted average traded price over the window, 0 if nothing traded
+unsigned long TradeFlow::vwap() const
+{
+    unsigned long volume = mBuyVolume + mSellVolume;
+    return (volume == 0) ? 0 : mNotional / volume;
+}
+
+//Buyer initiated minus seller initiated volume over the window
+signed long TradeFlow::signedVolume() const
+{
+    return (signed long)mBuyVolume - (signed long)mSellVolume;
+}
 
-        mAsks.erase(clientOrderId);
-        mBids.erase(clientOrderId);
+//signedVolume as a fraction of all traded volume, from -1 (all selling) to 1 (all buying)
+double TradeFlow::imbalance() const
+{
+    unsigned long volume = mBuyVolume + mSellVolume;
+    return (volume == 0) ? 0.0 : (double)signedVolume() / (double)volume;
+}
+
+SignalBank::SignalBank(const std::array<double, SIGNAL_HORIZONS>& halfLives)
+{
+    for (std::size_t h = 0; h < SIGNAL_HORIZONS; h++)
+    {
+        mAlpha[h] = 1.0 - std::exp(std::log(0.5) / halfLives[h]);
     }
 }
 
+//Updates every horizon's EWMA mean and variance with one sample, a single branch-free pass over the bank
+void SignalBank::update(double x)
+{
+    if (mCount == 0)
+    {
+        mMean.fill(x);
+    }
+    for (std::size_t h = 0; h < SIGNAL_HORIZONS; h++)
+    {
+        double diff = x - mMean[h];
+        double step = mAlpha[h] * diff;
+        mMean[h] += step;
+        mVariance[h] = (1.0 - mAlpha[h]) * (mVariance[h] + diff * step);
+    }
+    mLast = x;
+    mCount++;
+}
 
-//Updated from exchange
-void AutoTrader::TradeTicksMessageHandler(Instrument instrument,
-                                          unsigned long sequenceNumber,
-                                          const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
-                                          const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
-                                          const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
-                                          const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes)
+//How many standard deviations the latest sample is from this horizon's mean
+double SignalBank::zScore(std::size_t horizon) const
 {
-    RLOG(LG_AT, LogLevel::LL_INFO) << "trade ticks received for " << instrument << " instrument"
-                                   << ": ask prices: " << askPrices[0]
-                                   << "; ask volumes: " << askVolumes[0]
-                                   << "; bid prices: " << bidPrices[0]
-                                   << "; bid volumes: " << bidVolumes[0];
+    double sd = std::sqrt(mVariance[horizon]);
+    return (sd == 0) ? 0.0 : (mLast - mMean[horizon]) / sd;
+}
 
-    if (instrument == Instrument::ETF)
+double SignalBank::mean(std::size_t horizon) const
+{
+    return mMean[horizon];
+}
+
+unsigned long SignalBank::count() const
+{
+    return mCount;
+}
+
+//Keeps the fill until its last horizon has been sampled, the key names the fill and is later split into slot and horizon
+std::uint64_t MarkoutEngine::record(Side side, unsigned long price, unsigned long volume)
+{
+    std::uint64_t fill = mNextFill++;
+    mFills[fill % MARKOUT_CAPACITY] = {fill, side, price, volume};
+    return fill * MARKOUT_HORIZONS;
+}
+
+//key + horizon from record(), a fill that has since been overwritten is dropped
+void MarkoutEngine::sample(std::uint64_t key, unsigned long midprice)
+{
+    std::uint64_t fill = key / MARKOUT_HORIZONS;
+    std::size_t horizon = key % MARKOUT_HORIZONS;
+    const MarkoutFill& f = mFills[fill % MARKOUT_CAPACITY];
+    if (f.fill != fill || midprice == 0)
     {
-        //retrieving data
-        ETF_ask_arr = askPrices;
-        ETF_bid_arr = bidPrices;
-        ETF_bestAsk = askPrices[0];
-        ETF_bestBid = bidPrices[0];
-        //storing midprice
-        ETF_midprice = (ETF_bestAsk + ETF_bestBid) / 2;
+        return;
+    }
+
+    double markout = (f.side == Side::BUY) ? (double)midprice - (double)f.price : (double)f.price - (double)midprice;
+    MarkoutStats& s = mStats[f.side == Side::BUY][horizon];
+    s.fills++;
+    s.volume += f.volume;
+    s.sum += markout * f.volume;
+    s.sumSquares += markout * markout * f.volume;
+}
+
+const MarkoutStats& MarkoutEngine::stats(Side side, std::size_t horizon) const
+{
+    return mStats[side == Side::BUY][horizon];
+}
+
+static const char* const PERF_HANDLER_NAMES[] = {"OrderBook", "TradeTicks", "OrderFilled", "HedgeFilled"};
+
+static std::uint64_t readPmc(unsigned int counter)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int lo;
+    unsigned int hi;
+    __asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter));
+    return ((std::uint64_t)hi << 32) | lo;
+#else
+    (void)counter;
+    return 0;
+#endif
+}
 
-        if(ETF_recent_mp_prices.size() <= 31) //rolling avg for thirty
+//Opens one counter per event for this thread and maps its page so it can be read with rdpmc
+bool PerfCounters::open()
+{
+    const std::array<std::uint64_t, PERF_COUNTERS> configs = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                              PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (std::size_t i = 0; i < PERF_COUNTERS; i++)
+    {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        mFds[i] = (int)::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        void* page = (mFds[i] == -1) ? MAP_FAILED : ::mmap(nullptr, ::sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, mFds[i], 0);
+        if (page == MAP_FAILED)
         {
-            ETF_recent_mp_prices.push_back(ETF_midprice);   
+            RLOG(LG_AT, LogLevel::LL_INFO) << "perf counters: could not open counter " << i << ", instrumentation off";
+            close();
+            return false;
         }
-        else
+        mPages[i] = static_cast<perf_event_mmap_page*>(page);
+    }
+    mEnabled = true;
+    return true;
+}
+
+void PerfCounters::close()
+{
+    for (std::size_t i = 0; i < PERF_COUNTERS; i++)
+    {
+        if (mPages[i] != nullptr)
         {
-            ETF_recent_mp_prices.pop();
-            ETF_recent_mp_prices.push_back(ETF_midprice);
+            ::munmap(mPages[i], ::sysconf(_SC_PAGESIZE));
+            mPages[i] = nullptr;
         }
-
-        if(ETF_midprice != 0 && FTR_midprice != 0) //if game has started
+        if (mFds[i] != -1)
         {
-            //log
-            positionLog();
-            //if theres an even amount of samples, take the difference and add it to sample of differences then check if we should trade
-            if(ETF_recent_mp_prices.size() == FTR_recent_mp_prices.size())
-            {
-                DIFF_recent_mp_prices.push_back(ETF_recent_mp_prices[ETF_recent_mp_prices.size()-1] - FTR_recent_mp_prices[FTR_recent_mp_prices.size()-1]);
-                deterMineOrderStatus(DIFF_recent_mp_prices); //<== determines ETF_Much_Greater/FTR_Much_Greater
-            }
-            
+            ::close(mFds[i]);
+            mFds[i] = -1;
+        }
+    }
+    mEnabled = false;
+}
 
-            if(ETF_Much_Greater == true && ETF_Pos - std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]) > -100)
-            {
-                //send a Ask/Sell order at the best bid
-                unsigned long tempID = mAskID;
-                SendInsertOrder(mAskID, Side::SELL, ETF_bestBid, std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_ETF_ask_arr.push_back(ETF_bestBid);
-                my_ETF_ask_ids.push_back(ETF_tempID)
-                my_ETF_ask_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Etf Ask/Sell Placed~~~~~~~~";  
-                positionLog();
-                //send a Buy order at the best ask for FTR
-                unsigned int tempID2 = mAskID;
-                SendHedgeOrder(mAskID, SIDE::BUY, FTR_bestAsk, std::min((unsigned long)LOT_SIZE, FTR_ask_vol_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_FTR_bid_arr.push_back(FTR_bestAsk);
-                my_FTR_ask_ids.push_back(tempID2);
-                my_FTR_bid_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, FTR_ask_vol_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Hedge Bid/Buy Placed~~~~~~~~";  
-                positionLog();
-                
-            } else if(FTR_Much_Greater == true && ETF_Pos + std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]) < 100)
+//Reads a counter from user space, retrying if the kernel updated the page part way through
+std::uint64_t PerfCounters::readCounter(std::size_t i) const
+{
+    const volatile perf_event_mmap_page* page = mPages[i];
+    std::uint32_t seq;
+    std::uint64_t count;
+    do
+    {
+        seq = page->lock;
+        std::atomic_signal_fence(std::memory_order_acquire);
+        std::uint32_t index = page->index;
+        count = page->offset;
+        if (!page->cap_user_rdpmc || index == 0)
+        {
+            //counter not scheduled on a hardware register, fall back to the syscall
+            if (::read(mFds[i], &count, sizeof(count)) != sizeof(count))
             {
-                 //send an ETF Bid/Buy order at the best ask
-                unsigned long tempID = mAskID;
-                SendInsertOrder(mAskID, Side::BUY, ETF_bestAsk, std::min((unsigned long)LOT_SIZE, ETF_ask_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_ETF_bid_arr.push_back(ETF_bestAsk);
-                my_ETF_bid_ids.push_back(tempID);
-                my_etf_bid_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, ETF_ask_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Etf Ask/Sell Placed~~~~~~~~";  
-                positionLog();
-                //send a Ask/Sell order at the best bid for FTR
-                unsigned long tempID2 = mAskID;
-                SendHedgeOrder(mAskID, SIDE::SELL, FTR_bestBid, std::min((unsigned long)LOT_SIZE, FTR_bid_vol_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_FTR_ask_arr.push_back(FTR_bestBid);
-                my_FTR_ask_ids.push_back(tempID2);
-                my_FTR_ask_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, FTR_bid_vol_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Hedge Bid/Buy Placed~~~~~~~~";  
-                positionLog();
+                count = 0;
             }
+            return count;
         }
+        unsigned int width = page->pmc_width;
+        std::int64_t pmc = (std::int64_t)(readPmc(index - 1) << (64 - width)) >> (64 - width);
+        count += pmc;
+        std::atomic_signal_fence(std::memory_order_acquire);
+    } while (page->lock != seq);
+    return count;
+}
+
+PerfSample PerfCounters::read() const
+{
+    PerfSample sample{};
+    for (std::size_t i = 0; mEnabled && i < PERF_COUNTERS; i++)
+    {
+        sample[i] = readCounter(i);
     }
-//=------------------------------------------------------------------------------------------------------------------------------------=
-    if (instrument == Instrument::FUTURE)
+    return sample;
+}
+
+void PerfCounters::add(PerfHandler handler, const PerfSample& start)
+{
+    PerfSample end = read();
+    std::size_t h = (std::size_t)handler;
+    for (std::size_t i = 0; i < PERF_COUNTERS; i++)
     {
-        FTR_ask_arr = askPrices;
-        FTR_bid_arr = bidPrices;
-        FTR_bestAsk = askPrices[0];
-        FTR_bestBid = bidPrices[0];
-        //storing midprice
-        FTR_midprice = (FTR_bestAsk + FTR_bestBid) / 2;
+        mTotals[h][i] += end[i] - start[i];
+    }
+    mCalls[h]++;
+}
+
+void PerfCounters::reset()
+{
+    mTotals = {};
+    mCalls = {};
+}
 
-        if(FTR_recent_mp_prices.size() <= 31) //rolling avg for thirty
+//Per handler averages over the session
+void PerfCounters::report() const
+{
+    if (!mEnabled)
+    {
+        return;
+    }
+    for (std::size_t h = 0; h < PERF_HANDLERS; h++)
+    {
+        if (mCalls[h] == 0)
         {
-            FTR_recent_mp_prices.push_back(FTR_midprice);   
+            continue;
         }
-        else
+        const PerfSample& t = mTotals[h];
+        RLOG(LG_AT, LogLevel::LL_INFO) << "perf " << PERF_HANDLER_NAMES[h] << ": " << mCalls[h] << " calls"
+                                       << ", cycles/call " << t[0] / mCalls[h]
+                                       << ", IPC " << ((t[0] == 0) ? 0.0 : (double)t[1] / (double)t[0])
+                                       << ", cache misses/call " << (double)t[2] / mCalls[h]
+                                       << ", branch misses/call " << (double)t[3] / mCalls[h];
+    }
+}
+
+PerfScope::PerfScope(PerfCounters& counters, PerfHandler handler) : mCounters(counters), mHandler(handler)
+{
+    if (mCounters.enabled())
+    {
+        mStart = mCounters.read();
+    }
+}
+
+PerfScope::~PerfScope()
+{
+    if (mCounters.enabled())
+    {
+        mCounters.add(mHandler, mStart);
+    }
+}
+
+static const char* const METRIC_HANDLER_NAMES[] = {"order_book", "trade_ticks", "order_filled", "hedge_filled",
+                                                   "order_status", "error"};
+static const char* const METRIC_COUNTER_NAMES[] = {"inserts", "amends", "cancels", "hedges", "rejects", "hedge_fills",
+                                                   "hedge_lots", "forced_hedges", "timer_failures", "shadow_drops",
+                                                   "journal_drops"};
+static const char* const METRIC_GAUGE_NAMES[] = {"etf_position", "future_position", "pnl_cents"};
+static const char* const ROUND_TRIP_LABELS[] = {"instrument=\"etf\",side=\"sell\",stage=\"ack\"",
+                                                "instrument=\"etf\",side=\"buy\",stage=\"ack\"",
+                                                "instrument=\"etf\",side=\"sell\",stage=\"fill\"",
+                                                "instrument=\"etf\",side=\"buy\",stage=\"fill\"",
+                                                "instrument=\"future\",side=\"sell\",stage=\"fill\"",
+                                                "instrument=\"future\",side=\"buy\",stage=\"fill\""};
+
+MetricsRegistry::~MetricsRegistry()
+{
+    {
+        std::lock_guard<std::mutex> lock(mStopMutex);
+        mStop = true;
+    }
+    mStopSignal.notify_all();
+    if (mWriter.joinable())
+    {
+        mWriter.join();
+    }
+}
+
+//Starts the thread that writes a snapshot every second, the trading thread never waits on it
+void MetricsRegistry::start(const std::string& fileName)
+{
+    mWriter = std::thread([this, fileName]()
+    {
+        std::unique_lock<std::mutex> lock(mStopMutex);
+        while (!mStopSignal.wait_for(lock, std::chrono::seconds(1), [this]() { return mStop; }))
         {
-            FTR_recent_mp_prices.pop();
-            FTR_recent_mp_prices.push_back(FTR_midprice);
+            write(fileName);
         }
+    });
+}
 
-        if(ETF_midprice != 0 && FTR_midprice != 0) //if game has started
-        {
-            //log
-            positionLog();
-            //if theres an even amount of samples, take the difference and add it to sample of differences then check if we should trade
-            if(ETF_recent_mp_prices.size() == FTR_recent_mp_prices.size())
-            {
-                DIFF_recent_mp_prices.push_back(ETF_recent_mp_prices[ETF_recent_mp_prices.size()-1] - FTR_recent_mp_prices[FTR_recent_mp_prices.size()-1]);
-                deterMineOrderStatus(DIFF_recent_mp_prices); //<== determines ETF_Much_Greater/FTR_Much_Greater
-            }
-            
+void MetricsRegistry::reset()
+{
+    for (auto& c : mCounters) { c.store(0, std::memory_order_relaxed); }
+    for (auto& g : mGauges) { g.store(0, std::memory_order_relaxed); }
+    for (auto& m : mMessages) { m.store(0, std::memory_order_relaxed); }
+    for (auto& histogram : mLatency)
+    {
+        for (auto& bucket : histogram) { bucket.store(0, std::memory_order_relaxed); }
+    }
+    for (auto& histogram : mRoundTrip)
+    {
+        for (auto& bucket : histogram) { bucket.store(0, std::memory_order_relaxed); }
+    }
+}
+
+//Latency goes into power of two nanosecond buckets
+static void addLatency(LatencyHistogram& histogram, std::uint64_t nanoseconds)
+{
+    std::size_t bucket = (nanoseconds == 0) ? 0 : std::min<std::size_t>(64 - __builtin_clzll(nanoseconds), LATENCY_BUCKETS - 1);
+    histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void MetricsRegistry::recordMessage(MetricHandler handler, std::uint64_t nanoseconds)
+{
+    std::size_t h = (std::size_t)handler;
+    mMessages[h].fetch_add(1, std::memory_order_relaxed);
+    addLatency(mLatency[h], nanoseconds);
+}
+
+void MetricsRegistry::recordRoundTrip(RoundTrip stage, std::uint64_t nanoseconds)
+{
+    addLatency(mRoundTrip[(std::size_t)stage], nanoseconds);
+}
+
+//Upper bound of the bucket holding the given quantile, 0 if there were no samples
+static std::uint64_t latencyQuantile(const LatencyHistogram& histogram, double quantile)
+{
+    std::array<std::uint64_t, LATENCY_BUCKETS> buckets;
+    for (std::size_t b = 0; b < LATENCY_BUCKETS; b++)
+    {
+        buckets[b] = histogram[b].load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t total = 0;
+    for (std::uint64_t count : buckets) { total += count; }
+    if (total == 0)
+    {
+        return 0;
+    }
+    std::uint64_t target = (std::uint64_t)std::ceil(quantile * total);
+    std::uint64_t seen = 0;
+    for (std::size_t b = 0; b < LATENCY_BUCKETS; b++)
+    {
+        seen += buckets[b];
+        if (seen >= target)
+        {
+            return (std::uint64_t)1 << b;
+        }
+    }
+    return (std::uint64_t)1 << (LATENCY_BUCKETS - 1);
+}
+
+//Writes to a temporary file and renames it over the old one so a scraper never sees half a snapshot
+void MetricsRegistry::write(const std::string& fileName) const
+{
+    std::string tempName = fileName + ".tmp";
+    {
+        std::ofstream out(tempName, std::ios::trunc);
+        out << "# TYPE autotrader_messages_total counter\n";
+        for (std::size_t h = 0; h < METRIC_HANDLERS; h++)
+        {
+            out << "autotrader_messages_total{handler=\"" << METRIC_HANDLER_NAMES[h] << "\"} "
+                << mMessages[h].load(std::memory_order_relaxed) << "\n";
+        }
+        for (std::size_t c = 0; c < METRIC_COUNTERS; c++)
+        {
+            out << "# TYPE autotrader_" << METRIC_COUNTER_NAMES[c] << "_total counter\n"
+                << "autotrader_" << METRIC_COUNTER_NAMES[c] << "_total " << mCounters[c].load(std::memory_order_relaxed) << "\n";
+        }
+        for (std::size_t g = 0; g < METRIC_GAUGES; g++)
+        {
+            out << "# TYPE autotrader_" << METRIC_GAUGE_NAMES[g] << " gauge\n"
+                << "autotrader_" << METRIC_GAUGE_NAMES[g] << " " << mGauges[g].load(std::memory_order_relaxed) << "\n";
+        }
+        out << "# TYPE autotrader_handler_latency_ns summary\n";
+        for (std::size_t h = 0; h < METRIC_HANDLERS; h++)
+        {
+            for (double quantile : {0.5, 0.9, 0.99, 0.999})
+            {
+                out << "autotrader_handler_latency_ns{handler=\"" << METRIC_HANDLER_NAMES[h] << "\",quantile=\""
+                    << quantile << "\"} " << latencyQuantile(mLatency[h], quantile) << "\n";
+            }
+        }
+        out << "# TYPE autotrader_order_round_trip_ns summary\n";
+        for (std::size_t r = 0; r < ROUND_TRIP_STAGES; r++)
+        {
+            for (double quantile : {0.5, 0.9, 0.99, 0.999})
+            {
+                out << "autotrader_order_round_trip_ns{" << ROUND_TRIP_LABELS[r] << ",quantile=\""
+                    << quantile << "\"} " << latencyQuantile(mRoundTrip[r], quantile) << "\n";
+            }
+        }
+    }
+    std::rename(tempName.c_str(), fileName.c_str());
+}
+
+MetricsScope::MetricsScope(MetricsRegistry& registry, MetricHandler handler)
+    : mRegistry(registry), mHandler(handler), mStart(std::chrono::steady_clock::now())
+{
+}
+
+MetricsScope::~MetricsScope()
+{
+    auto elapsed = std::chrono::steady_clock::now() - mStart;
+    mRegistry.recordMessage(mHandler, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+//Custom log function
+void TraderCore::positionLog()
+{
+    RLOG(LG_AT, LogLevel::LL_INFO) << "=---------------------------------=";
+    RLOG(LG_AT, LogLevel::LL_INFO) << "ETF Pos: " << ETF_Pos << std::endl;
+    RLOG(LG_AT, LogLevel::LL_INFO) << "Future Pos: " << FTR_Pos << std::endl;
+    RLOG(LG_AT, LogLevel::LL_INFO) << "PnL: " << totalPnL() << " (realised " << mPnL.etf.realised + mPnL.future.realised
+                                   << ", fees " << mPnL.etf.fees << ")" << std::endl;
+    for (std::size_t h = 0; h < MARKOUT_HORIZONS; h++)
+    {
+        RLOG(LG_AT, LogLevel::LL_INFO) << "Markout " << MARKOUT_HORIZONS_MS[h] << "ms: buys " << mMarkouts.stats(Side::BUY, h).mean()
+                                       << " sells " << mMarkouts.stats(Side::SELL, h).mean() << " cents/lot";
+    }
+    RLOG(LG_AT, LogLevel::LL_INFO) << "ETF VWAP: " << ETF_flow.vwap() << " imbalance: " << ETF_flow.imbalance()
+                                   << " | Future VWAP: " << FTR_flow.vwap() << " imbalance: " << FTR_flow.imbalance() << std::endl;
+    RLOG(LG_AT, LogLevel::LL_INFO) << "ETF Bids: " << std::endl;
+    for(int i = 0; i < ETF_bid_arr.size(); i++) { RLOG(LG_AT, LogLevel::LL_INFO) << "| " << ETF_bid_arr[i]; }
+    RLOG(LG_AT, LogLevel::LL_INFO) << "ETF Asks: " << std::endl;
+    for(int i = 0; i < ETF_ask_arr.size(); i++) { RLOG(LG_AT, LogLevel::LL_INFO) << "| " << ETF_ask_arr[i]; }
+    RLOG(LG_AT, LogLevel::LL_INFO) << "Future Bids: " << std::endl;
+    for(int i = 0; i < FTR_bid_arr.size(); i++) { RLOG(LG_AT, LogLevel::LL_INFO) << "| " << FTR_bid_arr[i]; }
+    RLOG(LG_AT, LogLevel::LL_INFO) << "Future Asks: " << std::endl;
+    for(int i = 0; i < FTR_ask_arr.size(); i++) { RLOG(LG_AT, LogLevel::LL_INFO) << "| " << FTR_ask_arr[i]; }
+}
+
+/* Function to check if the spread is "far enough" from its average to trade */
+void SpreadSignalStrategy::onSignal(const MarketView& view)
+{
+    //wait until the decision horizon has seen enough samples for its variance to mean anything
+    double z = view.signals.zScore(mConfig.horizon);
+    if (view.signals.count() < SIGNAL_WARMUP)
+    {
+        z = 0;
+    }
+
+    //enter past the threshold, hold until back inside the exit threshold, so a z-score hovering around either band
+    //does not flip the state on every update
+    if(z > mConfig.threshold)
+    {
+        mState = SpreadState::SHORT_ETF;
+    } else if(z < -mConfig.threshold)
+    {
+        mState = SpreadState::LONG_ETF;
+    } else if((mState == SpreadState::SHORT_ETF && z < mConfig.exitThreshold) ||
+              (mState == SpreadState::LONG_ETF && z > -mConfig.exitThreshold))
+    {
+        mState = SpreadState::FLAT;
+    }
+
+    //inside the bands the target only ever shrinks, so a z-score wobbling across a step boundary cannot buy and sell
+    //the same lots back and forth. Adding to the position again takes the full threshold
+    signed long target = (mState == SpreadState::FLAT) ? 0 : targetFor(z);
+    if (std::fabs(z) <= mConfig.threshold && std::labs(target) > std::labs(mTarget))
+    {
+        target = mTarget;
+    }
+    if (target != mTarget)
+    {
+        mTarget = target;
+        mRearm = true;
+    }
+}
+
+//Full size at the threshold and past it, shrinking with the z-score as the spread reverts. Whole lots only, so the
+//target moves in steps rather than with every update, and onSignal only lets it step back towards zero
+signed long SpreadSignalStrategy::targetFor(double z) const
+{
+    double scale = std::min(std::fabs(z) / mConfig.threshold, 1.0);
+    unsigned long lots = (unsigned long)(scale * mConfig.targetLots);
+    if (mConfig.lotSize != 0)
+    {
+        lots = lots / mConfig.lotSize * mConfig.lotSize;
+    }
+    //holding on the wrong side of zero never happens, the state is left first
+    if (mState == SpreadState::SHORT_ETF)
+    {
+        return (z > 0) ? -(signed long)lots : 0;
+    }
+    return (z < 0) ? (signed long)lots : 0;
+}
+
+SpreadSignalStrategy::SpreadSignalStrategy() : mConfig(defaultConfig())
+{
+}
+
+SpreadSignalStrategy::SpreadSignalStrategy(const SpreadSignalConfig& config) : mConfig(config)
+{
+    mConfig.horizon = std::min(mConfig.horizon, SIGNAL_HORIZONS - 1);
+    mConfig.ladderLevels = std::min(mConfig.ladderLevels, TOP_LEVEL_COUNT - 1);
+    mConfig.exitThreshold = std::min(mConfig.exitThreshold, mConfig.threshold);
+}
+
+SpreadSignalConfig SpreadSignalStrategy::defaultConfig()
+{
+    return {SIGNAL_HORIZON, SIGNAL_THRESHOLD, SIGNAL_EXIT_THRESHOLD, LOT_SIZE, TARGET_POSITION_LOTS, LADDER_LEVELS};
+}
+
+int SpreadSignalStrategy::signal() const
+{
+    return (mState == SpreadState::SHORT_ETF) ? 1 : ((mState == SpreadState::LONG_ETF) ? -1 : 0);
+}
+
+//The passive ladder reads one book level per quote
+std::size_t SpreadSignalStrategy::bookDepth() const
+{
+    return mConfig.ladderLevels;
+}
+
+//ETF position the strategy is working towards, 0 when flat
+signed long SpreadSignalStrategy::target() const
+{
+    return mTarget;
+}
+
+//Fills in the ETF ladder we want resting, signal order first, then passive levels
+void SpreadSignalStrategy::decide(const MarketView& view, signed long position, unsigned long askRoom,
+                                  unsigned long bidRoom, Ladder& asks, Ladder& bids)
+{
+    std::size_t askLevel = 0;
+    std::size_t bidLevel = 0;
+
+    //the signal order covers the gap to the target, entering or unwinding alike. It is priced when the target moves,
+    //turns round or passive fills add to the gap, and otherwise just shrinks as it fills. With a view it crosses the
+    //spread, once flat it only joins the touch so unwinding the ladder's inventory does not give its edge back
+    signed long gap = mTarget - position;
+    bool grown = (gap > 0) ? gap > std::max(mArmedGap, 0L) : gap < std::min(mArmedGap, 0L);
+    if (mRearm || grown)
+    {
+        bool take = mState != SpreadState::FLAT;
+        mTakePrice = ((gap > 0) == take) ? view.etfBestAsk : view.etfBestBid;
+        mRearm = false;
+    }
+    //a join-only order the market has moved away from would never fill, so it follows the touch out (never in)
+    if (mState == SpreadState::FLAT && mTakePrice != 0)
+    {
+        if (gap > 0 && view.etfBestBid > mTakePrice)
+        {
+            mTakePrice = view.etfBestBid;
+        } else if (gap < 0 && view.etfBestAsk != 0 && view.etfBestAsk < mTakePrice)
+        {
+            mTakePrice = view.etfBestAsk;
+        }
+    }
+    mArmedGap = gap;
+    unsigned long signalAsk = 0;
+    unsigned long signalBid = 0;
+    if (gap < 0 && mTakePrice != 0)
+    {
+        unsigned long volume = std::min((unsigned long)-gap, askRoom);
+        if (volume != 0)
+        {
+            asks[askLevel++] = {mTakePrice, volume};
+            askRoom -= volume;
+            signalAsk = mTakePrice;
+        }
+    } else if (gap > 0 && mTakePrice != 0)
+    {
+        unsigned long volume = std::min((unsigned long)gap, bidRoom);
+        if (volume != 0)
+        {
+            bids[bidLevel++] = {mTakePrice, volume};
+            bidRoom -= volume;
+            signalBid = mTakePrice;
+        }
+    }
+
+    //while the spread is extreme only quote the side that agrees with it
+    if(mState == SpreadState::SHORT_ETF)
+    {
+        bidRoom = 0;
+    } else if(mState == SpreadState::LONG_ETF)
+    {
+        askRoom = 0;
+    }
+
+    //passive levels around fair value, never inside the book's own level so we only ever join or sit behind it, and
+    //strictly behind our own signal order so the slot never crosses itself
+    unsigned long fair = view.fairValue;
+    for (std::size_t i = 0; fair != 0 && i < mConfig.ladderLevels; i++)
+    {
+        unsigned long away = (LADDER_EDGE_TICKS + i) * TICK_SIZE_IN_CENTS;
+
+        unsigned long askPrice = (fair + away + TICK_SIZE_IN_CENTS - 1) / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
+        askPrice = std::max(askPrice, view.etfAskPrices[i]);
+        if (signalBid != 0)
+        {
+            askPrice = std::max(askPrice, signalBid + TICK_SIZE_IN_CENTS);
+        }
+        unsigned long askVolume = std::min(mConfig.lotSize, askRoom);
+        if (askVolume != 0 && askPrice <= MAX_ASK_NEAREST_TICK)
+        {
+            asks[askLevel++] = {askPrice, askVolume};
+            askRoom -= askVolume;
+        }
+
+        if (fair > away)
+        {
+            unsigned long bidPrice = (fair - away) / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
+            if (view.etfBidPrices[i] != 0)
+            {
+                bidPrice = std::min(bidPrice, view.etfBidPrices[i]);
+            }
+            if (signalAsk != 0)
+            {
+                bidPrice = std::min(bidPrice, signalAsk - TICK_SIZE_IN_CENTS);
+            }
+            unsigned long bidVolume = std::min(mConfig.lotSize, bidRoom);
+            if (bidVolume != 0 && bidPrice >= MIN_BID_NEARST_TICK)
+            {
+                bids[bidLevel++] = {bidPrice, bidVolume};
+                bidRoom -= bidVolume;
+            }
+        }
+    }
+}
+
+//Once we have lost too much nothing new goes out and everything resting is pulled
+bool LossLimitRisk::allowTrading(const MarketView& view) const
+{
+    return view.pnl >= -MAX_LOSS_IN_CENTS;
+}
+
+//Lots we can still sell
+unsigned long LossLimitRisk::askRoom(const MarketView& view) const
+{
+    return (unsigned long)std::max(POSITION_LIMIT + view.etfPosition, 0L);
+}
+
+//Lots we can still buy
+unsigned long LossLimitRisk::bidRoom(const MarketView& view) const
+{
+    return (unsigned long)std::max(POSITION_LIMIT - view.etfPosition, 0L);
+}
+
+//Fills are netted over a fixed window however many lots are waiting
+int BatchedHedging::batchWindowMs(signed long) const
+{
+    return HEDGE_BATCH_WINDOW_MS;
+}
+
+//Applies a fill of signedVolume lots (positive = bought) at price, O(1)
+void InstrumentPnL::onFill(signed long signedVolume, unsigned long price)
+{
+    cash -= signedVolume * (signed long)price;
+
+    //the part of the fill that closes out the existing position realises against the average cost
+    if ((position > 0 && signedVolume < 0) || (position < 0 && signedVolume > 0))
+    {
+        signed long closed = std::min(std::labs(position), std::labs(signedVolume));
+        signed long direction = (position > 0) ? 1 : -1;
+        realised += (signed long)(((double)price - avgCost) * closed * direction);
+        position += (signedVolume > 0) ? closed : -closed;
+        signedVolume += (signedVolume > 0) ? -closed : closed;
+        if (position == 0)
+        {
+            avgCost = 0;
+        }
+    }
+
+    //whatever is left opens or adds to the position
+    if (signedVolume != 0)
+    {
+        avgCost = (avgCost * std::labs(position) + (double)price * std::labs(signedVolume))
+                  / (std::labs(position) + std::labs(signedVolume));
+        position += signedVolume;
+    }
+}
+
+//Cash plus the position valued at midprice, less fees
+signed long InstrumentPnL::markToMarket(unsigned long midprice) const
+{
+    return cash + position * (signed long)midprice - fees;
+}
+
+//Marked-to-market PnL across both instruments, only computed when someone asks for it
+signed long TraderCore::totalPnL() const
+{
+    return mPnL.etf.markToMarket(ETF_midprice) + mPnL.future.markToMarket(FTR_midprice);
+}
+
+//Price the ETF should trade at, the future's midprice plus the long run spread, leaned towards the future's trade flow
+unsigned long TraderCore::fairValue() const
+{
+    if (FTR_midprice == 0)
+    {
+        return 0;
+    }
+    return (unsigned long)((double)FTR_midprice + mSignals.mean(SIGNAL_FAIR_HORIZON)
+                           + FTR_flow.imbalance() * FLOW_SKEW_TICKS * TICK_SIZE_IN_CENTS);
+}
+
+//Diffs the wanted ladder against a strategy slot's live quotes by price: matching orders are kept, the rest
+//cancelled or inserted
+void TraderCore::applyLadder(std::size_t slot, Side side, const Ladder& desired)
+{
+    QuoteManager::Levels& live = (side == Side::SELL) ? mQuotes[slot].asks : mQuotes[slot].bids;
+    std::array<bool, TOP_LEVEL_COUNT> matched{};
+
+    for (std::size_t level = 0; level < TOP_LEVEL_COUNT; level++)
+    {
+        if (live[level].id == 0)
+        {
+            continue;
+        }
+
+        std::size_t j = 0;
+        while (j < TOP_LEVEL_COUNT && (matched[j] || desired[j].volume == 0 || desired[j].price != live[level].price))
+        {
+            j++;
+        }
+
+        if (j == TOP_LEVEL_COUNT)
+        {
+            updateQuote(slot, side, level, 0, 0);
+        }
+        else
+        {
+            //a partly filled order keeps its queue position rather than being topped back up
+            matched[j] = true;
+            updateQuote(slot, side, level, desired[j].price, std::min(desired[j].volume, live[level].volume - live[level].filled));
+        }
+    }
+
+    std::size_t level = 0;
+    for (std::size_t j = 0; j < TOP_LEVEL_COUNT; j++)
+    {
+        if (matched[j] || desired[j].volume == 0)
+        {
+            continue;
+        }
+        while (level < TOP_LEVEL_COUNT && live[level].id != 0)
+        {
+            level++;
+        }
+        if (level == TOP_LEVEL_COUNT)
+        {
+            break;
+        }
+        updateQuote(slot, side, level, desired[j].price, desired[j].volume);
+    }
+}
+
+//Shared risk gate for every strategy slot: clips a ladder to the position room earlier slots have not already
+//claimed and drops any price that would trade against another slot's ladder or resting quotes, then takes its volume
+//out of the room
+void TraderCore::gateLadder(std::size_t slot, RiskBudget& budget, Ladder& asks, Ladder& bids) const
+{
+    //later slots have not been updated yet, so their live quotes are what the exchange will see first
+    unsigned long lowestAsk = budget.lowestAsk;
+    unsigned long highestBid = budget.highestBid;
+    for (std::size_t other = 0; other < STRATEGY_SLOTS; other++)
+    {
+        for (std::size_t i = 0; other != slot && i < TOP_LEVEL_COUNT; i++)
+        {
+            const LiveQuote& ask = mQuotes[other].asks[i];
+            const LiveQuote& bid = mQuotes[other].bids[i];
+            if (ask.id != 0 && (lowestAsk == 0 || ask.price < lowestAsk))
+            {
+                lowestAsk = ask.price;
+            }
+            if (bid.id != 0 && bid.price > highestBid)
+            {
+                highestBid = bid.price;
+            }
+        }
+    }
+
+    for (QuoteTarget& ask : asks)
+    {
+        if (ask.volume == 0)
+        {
+            continue;
+        }
+        ask.volume = (highestBid != 0 && ask.price <= highestBid) ? 0 : std::min(ask.volume, budget.askRoom);
+        budget.askRoom -= ask.volume;
+    }
+    for (QuoteTarget& bid : bids)
+    {
+        if (bid.volume == 0)
+        {
+            continue;
+        }
+        bid.volume = (lowestAsk != 0 && bid.price >= lowestAsk) ? 0 : std::min(bid.volume, budget.bidRoom);
+        budget.bidRoom -= bid.volume;
+    }
+
+    for (const QuoteTarget& ask : asks)
+    {
+        if (ask.volume != 0 && (budget.lowestAsk == 0 || ask.price < budget.lowestAsk))
+        {
+            budget.lowestAsk = ask.price;
+        }
+    }
+    for (const QuoteTarget& bid : bids)
+    {
+        if (bid.volume != 0 && bid.price > budget.highestBid)
+        {
+            budget.highestBid = bid.price;
+        }
+    }
+}
+
+//Moves the live quote for a slot/side/level to price and volume (volume 0 = no quote) with as few messages as possible
+void TraderCore::updateQuote(std::size_t slot, Side side, std::size_t level, unsigned long price, unsigned long volume)
+{
+    LiveQuote& quote = (side == Side::SELL) ? mQuotes[slot].asks[level] : mQuotes[slot].bids[level];
+
+    if (quote.id != 0)
+    {
+        unsigned long remaining = quote.volume - quote.filled;
+        if (quote.price == price && remaining == volume)
+        {
+            return;
+        }
+        if (quote.price == price && volume != 0 && volume < remaining)
+        {
+            //amend can only take volume away, so it covers a same price shrink
+            quote.volume = quote.filled + volume;
+            sendAmend(quote.id, quote.volume);
+            mFlight.record(FlightEvent::AMEND, quote.id, quote.price, quote.volume, 0);
+            mMetrics.add(MetricCounter::AMENDS);
+            return;
+        }
+
+        //the id carries its side, so late fills on the cancelled order are still hedged
+        sendCancel(quote.id);
+        mFlight.record(FlightEvent::CANCEL, quote.id, quote.price, 0, 0);
+        mMetrics.add(MetricCounter::CANCELS);
+        RLOG(LG_AT, LogLevel::LL_INFO) << "cancelling order " << quote.id << " at " << quote.price;
+        mTimers.cancel(quote.expiry);
+        quote = LiveQuote();
+    }
+
+    if (volume == 0)
+    {
+        return;
+    }
+
+    quote.id = OrderId::make(Instrument::ETF, side, slot, level, nextSequence());
+    quote.price = price;
+    quote.volume = volume;
+    quote.filled = 0;
+    sendInsert(quote.id, side, price, volume);
+    orderRecord(quote.id).sentAt = nowNanoseconds();
+    quote.expiry = scheduleTimer(QUOTE_MAX_AGE_MS, TimerKind::QUOTE_EXPIRY, quote.id);
+    mFlight.record(FlightEvent::INSERT, quote.id, price, volume, (unsigned long)side);
+    mMetrics.add(MetricCounter::INSERTS);
+    if (side == Side::SELL)
+    {
+        RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Etf Ask/Sell Placed~~~~~~~~";
+    }
+    else
+    {
+        RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Etf Bid/Buy Placed~~~~~~~~";
+    }
+    positionLog();
+}
+
+//Returns the live quote with this id, or nullptr if it has been replaced or was never a quote
+LiveQuote* TraderCore::findQuote(unsigned long clientOrderId)
+{
+    if (OrderId::instrument(clientOrderId) != Instrument::ETF || OrderId::level(clientOrderId) >= TOP_LEVEL_COUNT
+        || OrderId::slot(clientOrderId) >= STRATEGY_SLOTS)
+    {
+        return nullptr;
+    }
+    QuoteManager& quotes = mQuotes[OrderId::slot(clientOrderId)];
+    QuoteManager::Levels& levels = (OrderId::side(clientOrderId) == Side::SELL) ? quotes.asks : quotes.bids;
+    LiveQuote& quote = levels[OrderId::level(clientOrderId)];
+    return (quote.id == clientOrderId) ? &quote : nullptr;
+}
+
+//Every order leaves through these: nothing while offline, the paper exchange for a shadow, otherwise the exchange
+void TraderCore::sendInsert(unsigned long id, Side side, unsigned long price, unsigned long volume)
+{
+    if (mOffline)
+    {
+        return;
+    }
+    if (mPaper != nullptr)
+    {
+        mPaper->insert(id, side, price, volume);
+        return;
+    }
+    SendInsertOrder(id, side, price, volume, Lifespan::GOOD_FOR_DAY);
+}
+
+void TraderCore::sendAmend(unsigned long id, unsigned long volume)
+{
+    if (mOffline)
+    {
+        return;
+    }
+    if (mPaper != nullptr)
+    {
+        mPaper->amend(id, volume);
+        return;
+    }
+    SendAmendOrder(id, volume);
+}
+
+void TraderCore::sendCancel(unsigned long id)
+{
+    if (mOffline)
+    {
+        return;
+    }
+    if (mPaper != nullptr)
+    {
+        mPaper->cancel(id);
+        return;
+    }
+    SendCancelOrder(id);
+}
+
+void TraderCore::sendHedge(unsigned long id, Side side, unsigned long price, unsigned long volume)
+{
+    if (mOffline)
+    {
+        return;
+    }
+    if (mPaper != nullptr)
+    {
+        mPaper->hedge(id, side, price, volume);
+        return;
+    }
+    SendHedgeOrder(id, side, price, volume);
+}
+
+//Sequence for the next order id, skipping any that would wrap to 0 so no id is ever 0
+unsigned long TraderCore::nextSequence()
+{
+    if (OrderId::sequence(mNextMessageId) == 0)
+    {
+        mNextMessageId++;
+    }
+    return mNextMessageId++;
+}
+
+//Per order bookkeeping for ETF orders, keyed by the id's sequence
+OrderRecord& TraderCore::orderRecord(unsigned long clientOrderId)
+{
+    OrderRecord& record = mOrders[OrderId::sequence(clientOrderId) % ORDER_RING_SIZE];
+    if (record.id != clientOrderId)
+    {
+        record = OrderRecord();
+        record.id = clientOrderId;
+    }
+    return record;
+}
+
+//Lots of FUTURE we are short of being flat overall, counting hedges already sent (positive = need to sell)
+signed long TraderCore::unhedgedLots() const
+{
+    return ETF_Pos + FTR_Pos + mHedges.inFlight;
+}
+
+//Called whenever the ETF position changes, batches hedging over batchWindowMs
+void TraderCore::scheduleHedge(int batchWindowMs)
+{
+    if (batchWindowMs == 0 || mOffline)
+    {
+        flushHedges();
+        return;
+    }
+    if (mHedges.flushScheduled)
+    {
+        return;
+    }
+
+    mHedges.flushScheduled = true;
+    mHedgeTimer.expires_after(std::chrono::milliseconds(batchWindowMs));
+    mHedgeTimer.async_wait([this](const boost::system::error_code& error)
+    {
+        if (!error)
+        {
+            flushHedges();
+        }
+    });
+}
+
+//Sends at most one hedge order covering everything that is not already hedged or in flight
+void TraderCore::flushHedges()
+{
+    mHedges.flushScheduled = false;
+
+    signed long unhedged = unhedgedLots();
+    if (unhedged == 0)
+    {
+        return;
+    }
+
+    //hedges are found by sequence, so skip any sequence whose slot still has a hedge in flight
+    Side side = (unhedged > 0) ? Side::SELL : Side::BUY;
+    unsigned long sequence = nextSequence();
+    for (std::size_t tries = 1; mHedges.pending[sequence % HEDGE_SLOTS].id != 0; tries++)
+    {
+        if (tries == HEDGE_SLOTS)
+        {
+            //every slot is waiting on an answer, the hedge deadlines free them and a later flush picks this up
+            RLOG(LG_AT, LogLevel::LL_INFO) << "no free hedge slot for " << unhedged << " lots";
+            return;
+        }
+        sequence = nextSequence();
+    }
+    unsigned long id = OrderId::make(Instrument::FUTURE, side, 0, 0, sequence);
+    if (unhedged > 0)
+    {
+        sendHedge(id, Side::SELL, MIN_BID_NEARST_TICK, unhedged);
+    }
+    else
+    {
+        sendHedge(id, Side::BUY, MAX_ASK_NEAREST_TICK, -unhedged);
+    }
+    mMetrics.add(MetricCounter::HEDGES);
+    mFlight.record(FlightEvent::HEDGE, id, 0, std::labs(unhedged), (unsigned long)side);
+    TimerHandle deadline = scheduleTimer(HEDGE_DEADLINE_MS, TimerKind::HEDGE_DEADLINE, id);
+    mHedges.pending[OrderId::sequence(id) % HEDGE_SLOTS] = {id, -unhedged, nowNanoseconds(), deadline};
+    mHedges.inFlight -= unhedged;
+    RLOG(LG_AT, LogLevel::LL_INFO) << "hedge order " << id << " sent for " << -unhedged << " lots";
+}
+
+//Called whenever either position changes, only the crossing of the limit arms or disarms the watchdog
+void TraderCore::checkExposure()
+{
+    bool breached = std::labs(ETF_Pos + FTR_Pos) > UNHEDGED_LIMIT_LOTS;
+    if (breached == mWatchdog.breached)
+    {
+        return;
+    }
+
+    mWatchdog.breached = breached;
+    if (breached)
+    {
+        mWatchdog.breachedAt = nowNanoseconds();
+        mWatchdog.deadline = scheduleTimer(UNHEDGED_GRACE_MS, TimerKind::EXPOSURE_DEADLINE, 0);
+        RLOG(LG_AT, LogLevel::LL_INFO) << "unhedged by " << ETF_Pos + FTR_Pos << " lots";
+    }
+    else
+    {
+        mTimers.cancel(mWatchdog.deadline);
+        mWatchdog.deadline = 0;
+        RLOG(LG_AT, LogLevel::LL_INFO) << "hedged again after " << (nowNanoseconds() - mWatchdog.breachedAt) / 1000000 << "ms";
+    }
+}
+
+TimerWheel::TimerWheel()
+{
+    clear();
+}
+
+//Drops every timer and threads all the nodes onto the free list, generations keep counting so old handles stay dead
+void TimerWheel::clear()
+{
+    mSlots = {};
+    for (std::uint32_t i = 0; i < TIMER_CAPACITY; i++)
+    {
+        mNodes[i].kind = TimerKind::NONE;
+        mNodes[i].next = (i + 1 < TIMER_CAPACITY) ? i + 2 : 0;
+        mNodes[i].prev = 0;
+        mNodes[i].generation++;
+    }
+    mFree = 1;
+    mActive = 0;
+}
+
+//Fires delayTicks after the last tick expired, returns 0 if the pool is exhausted. Markouts are only a measurement, so
+//they leave TIMER_RESERVED nodes for the timers the trading depends on
+TimerHandle TimerWheel::schedule(std::uint64_t delayTicks, TimerKind kind, unsigned long arg)
+{
+    if (mFree == 0 || (kind == TimerKind::MARKOUT && mActive + TIMER_RESERVED >= TIMER_CAPACITY))
+    {
+        return 0;
+    }
+
+    std::uint32_t index = mFree - 1;
+    TimerNode& node = mNodes[index];
+    mFree = node.next;
+
+    node.due = mTick + delayTicks;
+    node.arg = arg;
+    node.kind = kind;
+    std::uint32_t& head = mSlots[node.due & (TIMER_WHEEL_SLOTS - 1)];
+    node.prev = 0;
+    node.next = head;
+    if (head != 0)
+    {
+        mNodes[head - 1].prev = index + 1;
+    }
+    head = index + 1;
+    mActive++;
+    return ((TimerHandle)node.generation << 32) | (index + 1);
+}
+
+//Takes a node out of its slot and gives it back to the pool
+void TimerWheel::unlink(std::uint32_t index)
+{
+    TimerNode& node = mNodes[index];
+    if (node.prev != 0)
+    {
+        mNodes[node.prev - 1].next = node.next;
+    }
+    else
+    {
+        mSlots[node.due & (TIMER_WHEEL_SLOTS - 1)] = node.next;
+    }
+    if (node.next != 0)
+    {
+        mNodes[node.next - 1].prev = node.prev;
+    }
+
+    node.kind = TimerKind::NONE;
+    node.generation++;
+    node.prev = 0;
+    node.next = mFree;
+    mFree = index + 1;
+    mActive--;
+}
+
+//Safe to call with 0 or with a handle whose timer already fired
+void TimerWheel::cancel(TimerHandle handle)
+{
+    std::uint32_t index = (std::uint32_t)handle;
+    if (index == 0 || index > TIMER_CAPACITY)
+    {
+        return;
+    }
+    TimerNode& node = mNodes[index - 1];
+    if (node.generation != (std::uint32_t)(handle >> 32) || node.kind == TimerKind::NONE)
+    {
+        return;
+    }
+    unlink(index - 1);
+}
+
+//Hands back one timer due at or before nowTick per call, false once everything up to nowTick has fired
+bool TimerWheel::expire(std::uint64_t nowTick, TimerKind& kind, unsigned long& arg)
+{
+    while (mTick <= nowTick)
+    {
+        //timers a full turn or more away share the slot and are left for a later pass
+        std::uint32_t index = mSlots[mTick & (TIMER_WHEEL_SLOTS - 1)];
+        while (index != 0 && mNodes[index - 1].due > mTick)
+        {
+            index = mNodes[index - 1].next;
+        }
+        if (index != 0)
+        {
+            kind = mNodes[index - 1].kind;
+            arg = mNodes[index - 1].arg;
+            unlink(index - 1);
+            return true;
+        }
+        mTick++;
+    }
+    return false;
+}
+
+//Every timer goes through here so a full pool is never silent, a lost markout is only counted
+TimerHandle TraderCore::scheduleTimer(int delayMs, TimerKind kind, unsigned long arg)
+{
+    TimerHandle handle = mTimers.schedule(delayMs / TIMER_TICK_MS, kind, arg);
+    if (handle == 0)
+    {
+        mMetrics.add(MetricCounter::TIMER_FAILURES);
+        if (kind != TimerKind::MARKOUT)
+        {
+            RLOG(LG_AT, LogLevel::LL_ERROR) << "timer wheel full, " << (int)kind << " timer for " << arg << " lost";
+        }
+    }
+    return handle;
+}
+
+//Advances the wheel to the current tick off the io_context, deadlines are absolute so late wake ups do not drift
+void TraderCore::scheduleTimerTick()
+{
+    mWheelTimer.expires_at(mWheelTimer.expiry() + std::chrono::milliseconds(TIMER_TICK_MS));
+    mWheelTimer.async_wait([this](const boost::system::error_code& error)
+    {
+        if (error)
+        {
+            return;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - mWheelStart;
+        std::uint64_t nowTick = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / TIMER_TICK_MS;
+        TimerKind kind;
+        unsigned long arg;
+        while (mTimers.expire(nowTick, kind, arg))
+        {
+            onTimer(kind, arg);
+        }
+        scheduleTimerTick();
+    });
+}
+
+void TraderCore::onTimer(TimerKind kind, unsigned long arg)
+{
+    if (kind == TimerKind::HOUSEKEEPING)
+    {
+        saveCheckpoint();
+        scheduleCheckpoint();
+    }
+    else if (kind == TimerKind::QUOTE_EXPIRY)
+    {
+        LiveQuote* quote = findQuote(arg);
+        if (quote == nullptr)
+        {
+            return;
+        }
+        //every book either re-runs the ladders, which pull whatever they no longer want, or left their inputs as they
+        //were, so a quote still live after a recent book is wanted and only gets a fresh expiry. Quotes are pulled
+        //once the feed has been quiet for QUOTE_MAX_AGE_MS and nothing is confirming them any more
+        std::int64_t idleMs = (nowNanoseconds() - mLastBook) / 1000000;
+        if (idleMs < QUOTE_MAX_AGE_MS)
+        {
+            quote->expiry = scheduleTimer(QUOTE_MAX_AGE_MS - (int)idleMs, TimerKind::QUOTE_EXPIRY, arg);
+            return;
+        }
+        RLOG(LG_AT, LogLevel::LL_INFO) << "order " << arg << " expired, no order book for " << idleMs << "ms";
+        quote->expiry = 0;
+        updateQuote(OrderId::slot(arg), OrderId::side(arg), OrderId::level(arg), 0, 0);
+    }
+    else if (kind == TimerKind::HEDGE_DEADLINE)
+    {
+        PendingHedge& hedge = mHedges.pending[OrderId::sequence(arg) % HEDGE_SLOTS];
+        if (hedge.id != arg)
+        {
+            return;
+        }
+        if (hedge.expired)
+        {
+            //never heard back, give the slot up
+            RLOG(LG_AT, LogLevel::LL_INFO) << "hedge order " << arg << " abandoned";
+            hedge = PendingHedge();
+            scheduleHedge(0);
+            return;
+        }
+
+        //stop counting it as in flight so the retry covers it, a late fill is still booked and re-hedged
+        RLOG(LG_AT, LogLevel::LL_INFO) << "hedge order " << arg << " missed its deadline, re-hedging";
+        hedge.expired = true;
+        hedge.deadline = scheduleTimer(HEDGE_DEADLINE_MS, TimerKind::HEDGE_DEADLINE, arg);
+        mHedges.inFlight -= hedge.lots;
+        scheduleHedge(0);
+    }
+    else if (kind == TimerKind::MARKOUT)
+    {
+        mMarkouts.sample(arg, ETF_midprice);
+    }
+    else if (kind == TimerKind::EXPOSURE_DEADLINE)
+    {
+        //still over the limit after the grace period, hedge the lot now rather than wait for a batch or a deadline
+        RLOG(LG_AT, LogLevel::LL_INFO) << "unhedged by " << ETF_Pos + FTR_Pos << " lots for "
+                                       << (nowNanoseconds() - mWatchdog.breachedAt) / 1000000 << "ms, forcing a hedge";
+        mMetrics.add(MetricCounter::FORCED_HEDGES);
+        mHedges.inFlight = 0;
+        for (PendingHedge& hedge : mHedges.pending)
+        {
+            hedge.expired = hedge.expired || hedge.id != 0;
+        }
+        flushHedges();
+        mWatchdog.deadline = scheduleTimer(UNHEDGED_RETRY_MS, TimerKind::EXPOSURE_DEADLINE, 0);
+    }
+}
+
+//Misc
+void TraderCore::DisconnectHandler()
+{
+    BaseAutoTrader::DisconnectHandler();
+    RLOG(LG_AT, LogLevel::LL_INFO) << "execution connection lost";
+    saveCheckpoint();
+    mFlight.record(FlightEvent::DISCONNECT, 0, 0, 0, 0);
+    mPerf.report();
+    //the process usually goes away after a disconnect, so this one is on disk before the handler returns
+    mFlight.dump("disconnect");
+    mFlight.wait();
+}
+
+//Error logger
+void TraderCore::ErrorMessageHandler(unsigned long clientOrderId,
+                                     const std::string& errorMessage)
+{
+    MetricsScope metrics(mMetrics, MetricHandler::ERROR);
+    mMetrics.add(MetricCounter::REJECTS);
+    RLOG(LG_AT, LogLevel::LL_INFO) << "error with order " << clientOrderId << ": " << errorMessage;
+    mFlight.record(FlightEvent::ERROR, clientOrderId, 0, 0, 0);
+    //errors such as a cancel crossing a fill are routine, so only the first and then one every so often are dumped
+    mFlight.dump("error", FLIGHT_ERROR_DUMP_INTERVAL_MS);
+    if (clientOrderId != 0 && OrderId::instrument(clientOrderId) == Instrument::ETF)
+    {
+        OrderStatusMessageHandler(clientOrderId, 0, 0, orderRecord(clientOrderId).fees);
+    }
+    else if (clientOrderId != 0)
+    {
+        //a rejected hedge is the same as one that did not fill
+        HedgeFilledMessageHandler(clientOrderId, 0, 0);
+    }
+}
+
+//Hedge Function Logger, true if some of the hedge is left to redo
+bool TraderCore::onHedgeFilled(unsigned long clientOrderId, unsigned long price, unsigned long volume)
+{
+    RLOG(LG_AT, LogLevel::LL_INFO) << "hedge order " << clientOrderId << " filled for " << volume
+                                   << " lots at $" << price << " average price in cents";
+    mFlight.record(FlightEvent::HEDGE_FILL, clientOrderId, price, volume, 0);
+
+    PendingHedge& hedge = mHedges.pending[OrderId::sequence(clientOrderId) % HEDGE_SLOTS];
+    if (hedge.id != clientOrderId)
+    {
+        return false;
+    }
+
+    //hedges fill immediately or not at all, so whatever is left over goes back to being unhedged
+    signed long requested = hedge.lots;
+    bool expired = hedge.expired;
+    mTimers.cancel(hedge.deadline);
+    if (volume != 0)
+    {
+        mMetrics.recordRoundTrip((requested > 0) ? RoundTrip::HEDGE_BUY_FILL : RoundTrip::HEDGE_SELL_FILL,
+                                 nowNanoseconds() - hedge.sentAt);
+    }
+    hedge = PendingHedge();
+    if (!expired)
+    {
+        mHedges.inFlight -= requested;
+    }
+    FTR_Pos += (requested > 0) ? (long)volume : -(long)volume;
+    mMetrics.add(MetricCounter::HEDGE_FILLS);
+    mMetrics.add(MetricCounter::HEDGE_LOTS, volume);
+    mMetrics.set(MetricGauge::FUTURE_POSITION, FTR_Pos);
+    mPnL.future.onFill((requested > 0) ? (long)volume : -(long)volume, price);
+    checkExposure();
+    return expired || (unsigned long)std::labs(requested) != volume;
+}
+
+//Called 4 times a second by exchange (2 time Instrument = ETF, 2 times Instrument = FUTURE)
+BookUpdate TraderCore::onOrderBook(Instrument instrument,
+                                   unsigned long sequenceNumber,
+                                   const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
+                                   const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
+                                   const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
+                                   const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes)
+{
+    RLOG(LG_AT, LogLevel::LL_INFO) << "order book received for " << instrument << " instrument"
+                                   << ": ask prices: " << askPrices[0]
+                                   << "; ask volumes: " << askVolumes[0]
+                                   << "; bid prices: " << bidPrices[0]
+                                   << "; bid volumes: " << bidVolumes[0];  
+    mFlight.record(FlightEvent::BOOK, sequenceNumber, (unsigned long)instrument, askPrices[0], bidPrices[0]);
+    mLastBook = nowNanoseconds();
+    //the cancels and hedge it sends would be dropped while offline, so it waits for a real book
+    if (mReconcilePending && !mOffline)
+    {
+        reconcileRestoredOrders();
+    }
+
+    //only what the signal and the ladder read is compared, so deeper levels and volumes can change for free
+    bool midChanged = false;
+    bool quoteChanged = false;
+
+    if (instrument == Instrument::ETF)
+    {
+        unsigned long midprice = (askPrices[0] + bidPrices[0]) / 2;
+        midChanged = midprice != ETF_midprice;
+        quoteChanged = midChanged || askPrices[0] != ETF_bestAsk || bidPrices[0] != ETF_bestBid
+                       || askVolumes[0] != ETF_ask_vol_arr[0] || bidVolumes[0] != ETF_bid_vol_arr[0]
+                       || !std::equal(askPrices.begin(), askPrices.begin() + mBookDepth, ETF_ask_arr.begin())
+                       || !std::equal(bidPrices.begin(), bidPrices.begin() + mBookDepth, ETF_bid_arr.begin());
+
+        //retrieving data
+        ETF_ask_arr = askPrices;
+        ETF_ask_vol_arr = askVolumes;
+        ETF_bid_arr = bidPrices;
+        ETF_bid_vol_arr = bidVolumes;
+        ETF_bestAsk = askPrices[0];
+        ETF_bestBid = bidPrices[0];
+        //storing midprice
+        ETF_midprice = (ETF_bestAsk + ETF_bestBid) / 2;
+    }
+//=------------------------------------------------------------------------------------------------------------------------------------=
+    if (instrument == Instrument::FUTURE)
+    {
+        //the future only reaches the ladder through fair value
+        unsigned long midprice = (askPrices[0] + bidPrices[0]) / 2;
+        midChanged = midprice != FTR_midprice;
+        quoteChanged = midChanged || FTR_flowChanged;
+        FTR_flowChanged = false;
+
+        FTR_ask_arr = askPrices;
+        FTR_ask_vol_arr = askVolumes;
+        FTR_bid_arr = bidPrices;
+        FTR_bid_vol_arr = bidVolumes;
+        FTR_bestAsk = askPrices[0];
+        FTR_bestBid = bidPrices[0];
+        //storing midprice
+        FTR_midprice = (FTR_bestAsk + FTR_bestBid) / 2;
+    }
+
+    BookUpdate update;
+    if(ETF_midprice != 0 && FTR_midprice != 0 && quoteChanged) //if game has started and something we use moved
+    {
+        update.changed = true;
+        //feed the ETF-FUTURE spread to every horizon, the strategy decides whether to trade on it
+        if (midChanged)
+        {
+            mSignals.update((double)ETF_midprice - (double)FTR_midprice);
+            update.midChanged = true;
+        }
+    }
+    return update;
+}
+
+//ETF position built up by one strategy slot's orders, the slots add up to ETF_Pos
+signed long TraderCore::slotPosition(std::size_t slot) const
+{
+    return mSlotPositions[slot];
+}
+
+//Everything the policies read, by reference where it is more than a number
+MarketView TraderCore::marketView() const
+{
+    return {ETF_ask_arr, ETF_ask_vol_arr, ETF_bid_arr, ETF_bid_vol_arr, ETF_bestAsk, ETF_bestBid, ETF_midprice,
+            FTR_midprice, fairValue(), mSignals, ETF_flow, FTR_flow, ETF_Pos, FTR_Pos, totalPnL()};
+}
+
+
+
+//Order Message Logger, true if the ETF position changed
+bool TraderCore::onOrderFilled(unsigned long clientOrderId, unsigned long price, unsigned long volume)
+{
+    RLOG(LG_AT, LogLevel::LL_INFO) << "order " << clientOrderId << " filled for " << volume
+                                   << " lots at $" << price << " cents";
+    mFlight.record(FlightEvent::FILL, clientOrderId, price, volume, 0);
+    if (OrderId::instrument(clientOrderId) != Instrument::ETF)
+    {
+        return false;
+    }
+
+    std::uint64_t markout = mMarkouts.record(OrderId::side(clientOrderId), price, volume);
+    for (std::size_t h = 0; h < MARKOUT_HORIZONS; h++)
+    {
+        scheduleTimer(MARKOUT_HORIZONS_MS[h], TimerKind::MARKOUT, markout + h);
+    }
+
+    OrderRecord& record = orderRecord(clientOrderId);
+    if (!record.filled && record.sentAt != 0)
+    {
+        record.filled = true;
+        mMetrics.recordRoundTrip((OrderId::side(clientOrderId) == Side::SELL) ? RoundTrip::ETF_SELL_FILL : RoundTrip::ETF_BUY_FILL,
+                                 nowNanoseconds() - record.sentAt);
+    }
+
+    if (OrderId::side(clientOrderId) == Side::SELL)
+    {
+        ETF_Pos -= (long)volume;
+        mSlotPositions[OrderId::slot(clientOrderId) % STRATEGY_SLOTS] -= (long)volume;
+        mMetrics.set(MetricGauge::ETF_POSITION, ETF_Pos);
+        mPnL.etf.onFill(-(long)volume, price);
+    }
+    else
+    {
+        ETF_Pos += (long)volume;
+        mSlotPositions[OrderId::slot(clientOrderId) % STRATEGY_SLOTS] += (long)volume;
+        mMetrics.set(MetricGauge::ETF_POSITION, ETF_Pos);
+        mPnL.etf.onFill((long)volume, price);
+    }
+    checkExposure();
+    return true;
+}
+
+
+//Called when error rn (can use)
+void TraderCore::OrderStatusMessageHandler(unsigned long clientOrderId,
+                                           unsigned long fillVolume,
+                                           unsigned long remainingVolume,
+                                           signed long fees)
+{
+    MetricsScope metrics(mMetrics, MetricHandler::ORDER_STATUS);
+    mFlight.record(FlightEvent::STATUS, clientOrderId, fillVolume, remainingVolume, (unsigned long)fees);
+    LiveQuote* quote = findQuote(clientOrderId);
+    if (quote != nullptr)
+    {
+        quote->filled = fillVolume;
+    }
+
+    //fees are reported as a running total per order, so only the change is booked
+    OrderRecord& record = orderRecord(clientOrderId);
+    mPnL.etf.fees += fees - record.fees;
+    record.fees = fees;
+
+    //the first status back is the exchange acknowledging the insert
+    if (!record.acked && record.sentAt != 0)
+    {
+        record.acked = true;
+        mMetrics.recordRoundTrip((OrderId::side(clientOrderId) == Side::SELL) ? RoundTrip::ETF_SELL_ACK : RoundTrip::ETF_BUY_ACK,
+                                 nowNanoseconds() - record.sentAt);
+    }
+
+    if (remainingVolume == 0 && quote != nullptr)
+    {
+        mTimers.cancel(quote->expiry);
+        *quote = LiveQuote();
+    }
+}
+
+
+//Updated from exchange
+void TraderCore::onTradeTicks(Instrument instrument,
+                              unsigned long sequenceNumber,
+                              const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
+                              const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
+                              const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
+                              const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes)
+{
+    RLOG(LG_AT, LogLevel::LL_INFO) << "trade ticks received for " << instrument << " instrument"
+                                   << ": ask prices: " << askPrices[0]
+                                   << "; ask volumes: " << askVolumes[0]
+                                   << "; bid prices: " << bidPrices[0]
+                                   << "; bid volumes: " << bidVolumes[0];
+    mFlight.record(FlightEvent::TRADE_TICKS, sequenceNumber, (unsigned long)instrument, askPrices[0], bidPrices[0]);
+
+    //trades only feed the flow features, the book is left to OrderBookMessageHandler
+    if (instrument == Instrument::ETF)
+    {
+        ETF_flow.onTicks(askPrices, askVolumes, bidPrices, bidVolumes, ETF_bestAsk, ETF_bestBid);
+    }
+    else if (instrument == Instrument::FUTURE)
+    {
+        FTR_flow.onTicks(askPrices, askVolumes, bidPrices, bidVolumes, FTR_bestAsk, FTR_bestBid);
+        FTR_flowChanged = true;
+    }
+}
+
+
+//=------------------------------------------------------------------------------------------------------------------------------------=
+//Synthetic market data
+
+//Keeps or stops orders leaving the process, used to run the handlers on data that did not come from the exchange
+void TraderCore::setOffline(bool offline)
+{
+    mOffline = offline;
+}
+
+TraderMode TraderCore::mode() const
+{
+    return mMode;
+}
+
+void TraderCore::setPaperExchange(PaperExchange* paper)
+{
+    mPaper = paper;
+}
+
+void TraderCore::setShadow(ShadowTrader* shadow)
+{
+    mShadow = shadow;
+}
+
+//Gives a live trader a shadow of its own built by factory, once it has warmed up so only real messages are copied
+void TraderCore::startShadow(const TraderFactory& factory)
+{
+    if (!ENABLE_SHADOW_TRADER || mMode != TraderMode::LIVE)
+    {
+        return;
+    }
+    mOwnedShadow = std::make_unique<ShadowTrader>(factory, SHADOW_CPU);
+    mShadow = mOwnedShadow.get();
+}
+
+//Starts recording the live feed, after warm-up so the journal only holds real messages
+void TraderCore::startJournal()
+{
+    if (!ENABLE_JOURNAL || mMode != TraderMode::LIVE)
+    {
+        return;
+    }
+    std::string fileName = JOURNAL_PREFIX + std::to_string(wallNanoseconds() / 1000000000) + ".journal";
+    mJournal = std::make_unique<JournalRecorder>(fileName);
+    RLOG(LG_AT, LogLevel::LL_INFO) << "journal: recording to " << fileName;
+}
+
+//Hands a copy of a market data message to the shadow trader and the journal, if there are any, after the live
+//decision is done
+void TraderCore::publishMarket(MarketMessageType type,
+                               Instrument instrument,
+                               unsigned long sequenceNumber,
+                               const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
+                               const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
+                               const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
+                               const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes)
+{
+    //only the real feed is copied, not warm-up or replayed data
+    if ((mShadow == nullptr && mJournal == nullptr) || mOffline)
+    {
+        return;
+    }
+    MarketMessage message;
+    message.type = type;
+    message.instrument = (std::uint32_t)instrument;
+    message.sequence = sequenceNumber;
+    message.askPrices = askPrices;
+    message.askVolumes = askVolumes;
+    message.bidPrices = bidPrices;
+    message.bidVolumes = bidVolumes;
+    if (mShadow != nullptr && !mShadow->publish(message))
+    {
+        mMetrics.add(MetricCounter::SHADOW_DROPS);
+    }
+    if (mJournal != nullptr && !mJournal->publish(message))
+    {
+        mMetrics.add(MetricCounter::JOURNAL_DROPS);
+    }
+}
+
+//Hands a generated or journalled message to the matching handler
+void dispatchMarketMessage(TraderCore& trader, const MarketMessage& message)
+{
+    Instrument instrument = (Instrument)message.instrument;
+    if (message.type == MarketMessageType::ORDER_BOOK)
+    {
+        trader.OrderBookMessageHandler(instrument, message.sequence, message.askPrices, message.askVolumes,
+                                       message.bidPrices, message.bidVolumes);
+    }
+    else
+    {
+        trader.TradeTicksMessageHandler(instrument, message.sequence, message.askPrices, message.askVolumes,
+                                        message.bidPrices, message.bidVolumes);
+    }
+}
+
+MarketGenerator::MarketGenerator(const GeneratorConfig& config)
+    : mConfig(config), mRandom(config.seed), mFuture(config.startPrice)
+{
+    //a zero half spread would put the best ask below the best bid
+    mConfig.halfSpreadTicks = std::max(mConfig.halfSpreadTicks, 1UL);
+}
+
+//Produces the next message: FUTURE and ETF books alternate, each optionally followed by trade ticks on that book.
+//The future is a random walk and the ETF-FUTURE spread is mean reverting, so the two are cointegrated.
+const MarketMessage& MarketGenerator::next()
+{
+    std::normal_distribution<double> normal(0.0, 1.0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    if (mTradesPending)
+    {
+        mTradesPending = false;
+        makeTrades(uniform);
+        return mMessage;
+    }
+
+    mEtfNext = !mEtfNext;
+    if (mEtfNext)
+    {
+        mSpread += -mConfig.spreadReversion * mSpread + mConfig.spreadVolatility * normal(mRandom);
+    }
+    else
+    {
+        mFuture = std::max(mFuture + mConfig.volatility * normal(mRandom), (double)(10 * TICK_SIZE_IN_CENTS));
+    }
+    //a large negative spread must not take the ETF, or any of its bid levels, to zero or below
+    double floor = (double)((mConfig.halfSpreadTicks + TOP_LEVEL_COUNT) * TICK_SIZE_IN_CENTS);
+    double mid = std::max(mEtfNext ? mFuture + mSpread : mFuture, floor);
+
+    mMessage = MarketMessage();
+    mMessage.type = MarketMessageType::ORDER_BOOK;
+    mMessage.instrument = (std::uint32_t)(mEtfNext ? Instrument::ETF : Instrument::FUTURE);
+    mMessage.sequence = ++mSequence[mMessage.instrument];
+    unsigned long bestBid = (unsigned long)(mid / TICK_SIZE_IN_CENTS) * TICK_SIZE_IN_CENTS - (mConfig.halfSpreadTicks - 1) * TICK_SIZE_IN_CENTS;
+    unsigned long bestAsk = bestBid + (2 * mConfig.halfSpreadTicks - 1) * TICK_SIZE_IN_CENTS;
+    for (std::size_t i = 0; i < TOP_LEVEL_COUNT; i++)
+    {
+        //deeper levels hold more volume, with some noise so volumes change between updates
+        unsigned long volume = mConfig.depthVolume * (i + 1) + (unsigned long)(uniform(mRandom) * mConfig.depthVolume);
+        mMessage.askPrices[i] = bestAsk + i * TICK_SIZE_IN_CENTS;
+        mMessage.bidPrices[i] = bestBid - i * TICK_SIZE_IN_CENTS;
+        mMessage.askVolumes[i] = volume;
+        mMessage.bidVolumes[i] = volume;
+    }
+    mTradesPending = uniform(mRandom) < mConfig.tradeProbability;
+    return mMessage;
+}
+
+//Turns the book just sent into trade ticks: a few lots traded at the top one or two levels of one or both sides
+void MarketGenerator::makeTrades(std::uniform_real_distribution<double>& uniform)
+{
+    mMessage.type = MarketMessageType::TRADE_TICKS;
+    mMessage.sequence = ++mSequence[mMessage.instrument];
+    std::array<unsigned long, TOP_LEVEL_COUNT> askPrices{};
+    std::array<unsigned long, TOP_LEVEL_COUNT> askVolumes{};
+    std::array<unsigned long, TOP_LEVEL_COUNT> bidPrices{};
+    std::array<unsigned long, TOP_LEVEL_COUNT> bidVolumes{};
+    double side = uniform(mRandom);
+    std::size_t levels = (uniform(mRandom) < 0.2) ? 2 : 1;
+    for (std::size_t i = 0; i < levels; i++)
+    {
+        if (side < 0.6)
+        {
+            askPrices[i] = mMessage.askPrices[i];
+            askVolumes[i] = 1 + (unsigned long)(uniform(mRandom) * mMessage.askVolumes[i]);
+        }
+        if (side > 0.4)
+        {
+            bidPrices[i] = mMessage.bidPrices[i];
+            bidVolumes[i] = 1 + (unsigned long)(uniform(mRandom) * mMessage.bidVolumes[i]);
+        }
+    }
+    mMessage.askPrices = askPrices;
+    mMessage.askVolumes = askVolumes;
+    mMessage.bidPrices = bidPrices;
+    mMessage.bidVolumes = bidVolumes;
+}
+
+//Feeds count messages straight into the trader's handlers, paced at messagesPerSecond (0 = flat out)
+void MarketGenerator::drive(TraderCore& trader, unsigned long count)
+{
+    if (trader.mode() == TraderMode::LIVE)
+    {
+        RLOG(LG_AT, LogLevel::LL_ERROR) << "generator: refusing to drive a live trader, use a BENCHMARK one";
+        return;
+    }
+    trader.setOffline(true);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < count; i++)
+    {
+        const MarketMessage& message = next();
+        if (mConfig.messagesPerSecond > 0)
+        {
+            auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   std::chrono::duration<double>(i / mConfig.messagesPerSecond));
+            while (std::chrono::steady_clock::now() < due)
+            {
+            }
+        }
+        dispatchMarketMessage(trader, message);
+    }
+    trader.setOffline(false);
+}
+
+//Writes count messages to a journal file of fixed size MarketMessage records
+bool MarketGenerator::writeJournal(const std::string& fileName, unsigned long count)
+{
+    std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+    for (unsigned long i = 0; out && i < count; i++)
+    {
+        const MarketMessage& message = next();
+        out.write(reinterpret_cast<const char*>(&message), sizeof(MarketMessage));
+    }
+    return (bool)out;
+}
+
+JournalRecorder::JournalRecorder(const std::string& fileName)
+    : mThread(&JournalRecorder::run, this, fileName)
+{
+}
+
+//Stops once everything already pushed is on disk
+JournalRecorder::~JournalRecorder()
+{
+    mStop = true;
+    mThread.join();
+}
+
+//Called from the live thread, never blocks
+bool JournalRecorder::publish(const MarketMessage& message)
+{
+    if (!mQueue.push(message))
+    {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+std::uint64_t JournalRecorder::dropped() const
+{
+    return mDropped.load(std::memory_order_relaxed);
+}
+
+void JournalRecorder::run(std::string fileName)
+{
+    std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        RLOG(LG_AT, LogLevel::LL_ERROR) << "journal: could not open " << fileName;
+    }
+
+    MarketMessage message;
+    unsigned long count = 0;
+    while (true)
+    {
+        bool stopping = mStop.load(std::memory_order_acquire);
+        bool idle = true;
+        while (mQueue.pop(message))
+        {
+            idle = false;
+            out.write(reinterpret_cast<const char*>(&message), sizeof(MarketMessage));
+            count++;
+        }
+        if (stopping)
+        {
+            break;
+        }
+        if (idle)
+        {
+            out.flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(JOURNAL_IDLE_SLEEP_MS));
+        }
+    }
+    RLOG(LG_AT, LogLevel::LL_INFO) << "journal: stopped, " << count << " messages written to " << fileName << ", "
+                                   << dropped() << " dropped";
+}
+
+//Runs every message of a journal through the handlers with sending off, returns how many were replayed. This is
+//the workload used to train profile-guided builds and to benchmark recorded sessions. Offline runs leave the trader
+//with quotes, orders and strategy state that never reached the exchange, so live traders are refused.
+unsigned long replayJournal(TraderCore& trader, const std::string& fileName)
+{
+    if (trader.mode() == TraderMode::LIVE)
+    {
+        RLOG(LG_AT, LogLevel::LL_ERROR) << "replay: refusing to replay into a live trader, use a BENCHMARK one";
+        return 0;
+    }
+    std::ifstream in(fileName, std::ios::binary);
+    if (!in)
+    {
+        RLOG(LG_AT, LogLevel::LL_INFO) << "replay: could not open " << fileName;
+        return 0;
+    }
+
+    trader.setOffline(true);
+    MarketMessage message;
+    unsigned long count = 0;
+    while (in.read(reinterpret_cast<char*>(&message), sizeof(MarketMessage)))
+    {
+        dispatchMarketMessage(trader, message);
+        count++;
+    }
+    trader.setOffline(false);
+    return count;
+}
+
+//=------------------------------------------------------------------------------------------------------------------------------------=
+//Replay benchmarks
+
+//Benchmark builds define AUTOTRADER_COUNT_ALLOCATIONS so every heap allocation in the process is counted and new ones
+//on the hot path are caught. The trader itself is built without it and keeps the plain allocator, allocations then
+//always read 0
+#ifdef AUTOTRADER_COUNT_ALLOCATIONS
+static std::atomic<std::uint64_t> gAllocations{0};
+
+void* operator new(std::size_t size)
+{
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+std::uint64_t heapAllocations()
+{
+    return gAllocations.load(std::memory_order_relaxed);
+}
+#else
+std::uint64_t heapAllocations()
+{
+    return 0;
+}
+#endif
+
+//Replays a journal timing every message, the journal is read up front so only the handlers are measured
+BenchmarkResult benchmarkJournal(TraderCore& trader, const std::string& fileName)
+{
+    BenchmarkResult result;
+    result.session = fileName;
+
+    std::ifstream in(fileName, std::ios::binary);
+    std::vector<MarketMessage> messages;
+    MarketMessage message;
+    while (in.read(reinterpret_cast<char*>(&message), sizeof(MarketMessage)))
+    {
+        messages.push_back(message);
+    }
+    if (messages.empty() || trader.mode() == TraderMode::LIVE)
+    {
+        RLOG(LG_AT, LogLevel::LL_INFO) << "benchmark: no messages in " << fileName << " or a live trader given";
+        return result;
+    }
+
+    std::vector<std::uint64_t> latencies(messages.size());
+    trader.setOffline(true);
+    std::uint64_t allocations = heapAllocations();
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < messages.size(); i++)
+    {
+        auto before = std::chrono::steady_clock::now();
+        dispatchMarketMessage(trader, messages[i]);
+        latencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - before).count();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    result.allocations = heapAllocations() - allocations;
+    trader.setOffline(false);
+
+    std::sort(latencies.begin(), latencies.end());
+    result.messages = messages.size();
+    result.messagesPerSecond = messages.size() / std::chrono::duration<double>(elapsed).count();
+    result.p50 = latencies[latencies.size() * 50 / 100];
+    result.p99 = latencies[latencies.size() * 99 / 100];
+    result.p999 = latencies[latencies.size() * 999 / 1000];
+    return result;
+}
+
+//Replays each session into a fresh trader and compares against the baselines file (one line per session:
+//name messagesPerSecond p50 p99 p999 allocations). Anything worse than tolerance (0.1 = 10%) fails the run.
+//Sessions without a baseline get one appended, sessions that replay nothing fail. The traders run in BENCHMARK
+//mode, so every session starts flat.
+bool runBenchmarkSuite(boost::asio::io_context& context, const std::vector<std::string>& sessions,
+                       const std::string& baselineFile, double tolerance)
+{
+    std::map<std::string, BenchmarkResult> baselines;
+    {
+        std::ifstream in(baselineFile);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::istringstream fields(line);
+            BenchmarkResult b;
+            if (fields >> b.session >> b.messagesPerSecond >> b.p50 >> b.p99 >> b.p999 >> b.allocations)
+            {
+                baselines[b.session] = b;
+            }
+        }
+    }
+
+    bool passed = true;
+    std::ofstream newBaselines(baselineFile, std::ios::app);
+    for (const std::string& session : sessions)
+    {
+        BenchmarkResult result;
+        {
+            AutoTrader trader(context, {}, LossLimitRisk(), BatchedHedging(), TraderMode::BENCHMARK);
+            result = benchmarkJournal(trader, session);
+        }
+        RLOG(LG_AT, LogLevel::LL_INFO) << "benchmark " << session << ": " << result.messages << " messages, "
+                                       << result.messagesPerSecond << " msg/s, p50 " << result.p50 << "ns, p99 "
+                                       << result.p99 << "ns, p99.9 " << result.p999 << "ns, "
+                                       << result.allocations << " allocations";
+        if (result.messages == 0)
+        {
+            RLOG(LG_AT, LogLevel::LL_ERROR) << "benchmark " << session << ": FAILED, nothing replayed";
+            passed = false;
+            continue;
+        }
+
+        auto baseline = baselines.find(session);
+        if (baseline == baselines.end())
+        {
+            newBaselines << session << " " << result.messagesPerSecond << " " << result.p50 << " " << result.p99 << " "
+                         << result.p999 << " " << result.allocations << "\n";
+            RLOG(LG_AT, LogLevel::LL_INFO) << "benchmark " << session << ": no baseline, recorded this run as one";
+            continue;
+        }
+
+        const BenchmarkResult& b = baseline->second;
+        auto worse = [tolerance](double value, double base) { return value > base * (1 + tolerance); };
+        std::string failures;
+        if (result.messagesPerSecond < b.messagesPerSecond * (1 - tolerance))
+        {
+            failures += " throughput";
+        }
+        if (worse(result.p50, b.p50))
+        {
+            failures += " p50";
+        }
+        if (worse(result.p99, b.p99))
+        {
+            failures += " p99";
+        }
+        if (worse(result.p999, b.p999))
+        {
+            failures += " p99.9";
+        }
+        if (worse(result.allocations, b.allocations))
+        {
+            failures += " allocations";
+        }
+        if (!failures.empty())
+        {
+            RLOG(LG_AT, LogLevel::LL_ERROR) << "benchmark " << session << ": REGRESSION in" << failures
+                                            << " (baseline " << b.messagesPerSecond << " msg/s, p50 " << b.p50
+                                            << "ns, p99 " << b.p99 << "ns, p99.9 " << b.p999 << "ns, "
+                                            << b.allocations << " allocations)";
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+
+//=------------------------------------------------------------------------------------------------------------------------------------=
+//Shadow trading
+
+PaperExchange::PaperExchange()
+{
+    mEvents.reserve(4 * PAPER_ORDERS);
+    mDelivering.reserve(4 * PAPER_ORDERS);
+}
+
+PaperOrder* PaperExchange::find(unsigned long id)
+{
+    for (PaperOrder& order : mOrders)
+    {
+        if (order.id == id)
+        {
+            return &order;
+        }
+    }
+    return nullptr;
+}
+
+//Queues the fill and the status that follows it, the order is freed once nothing is left
+void PaperExchange::fill(PaperOrder& order, unsigned long price, unsigned long volume, bool aggressive)
+{
+    order.filled += volume;
+    order.fees += (signed long)std::lround((double)price * volume * (aggressive ? PAPER_TAKER_FEE : PAPER_MAKER_FEE));
+    mEvents.push_back({PaperEventType::FILL, order.id, price, volume, 0, 0});
+    status(order);
+    if (order.filled == order.volume)
+    {
+        order = PaperOrder();
+    }
+}
+
+void PaperExchange::status(const PaperOrder& order)
+{
+    mEvents.push_back({PaperEventType::STATUS, order.id, 0, order.filled, order.volume - order.filled, order.fees});
+}
+
+//Rests the order, taking whatever the last book offers at or through its price first
+void PaperExchange::insert(unsigned long id, Side side, unsigned long price, unsigned long volume)
+{
+    PaperOrder* order = find(0);
+    if (order == nullptr)
+    {
+        mEvents.push_back({PaperEventType::STATUS, id, 0, 0, 0, 0});
+        return;
+    }
+    *order = {id, side, price, volume, 0, 0};
+    status(*order);
+
+    const std::array<unsigned long, TOP_LEVEL_COUNT>& prices = (side == Side::BUY) ? mEtfBook.askPrices : mEtfBook.bidPrices;
+    const std::array<unsigned long, TOP_LEVEL_COUNT>& volumes = (side == Side::BUY) ? mEtfBook.askVolumes : mEtfBook.bidVolumes;
+    for (std::size_t i = 0; i < TOP_LEVEL_COUNT && order->id == id; i++)
+    {
+        bool crosses = (side == Side::BUY) ? prices[i] <= price : prices[i] >= price;
+        if (prices[i] == 0 || volumes[i] == 0 || !crosses)
+        {
+            break;
+        }
+        fill(*order, prices[i], std::min(volumes[i], order->volume - order->filled), true);
+    }
+}
+
+void PaperExchange::amend(unsigned long id, unsigned long volume)
+{
+    PaperOrder* order = find(id);
+    if (order == nullptr || volume >= order->volume)
+    {
+        return;
+    }
+    order->volume = std::max(volume, order->filled);
+    status(*order);
+    if (order->filled == order->volume)
+    {
+        *order = PaperOrder();
+    }
+}
+
+void PaperExchange::cancel(unsigned long id)
+{
+    PaperOrder* order = find(id);
+    if (order == nullptr)
+    {
+        return;
+    }
+    order->volume = order->filled;
+    status(*order);
+    *order = PaperOrder();
+}
+
+//Hedges fill in full at the future's touch as long as the limit allows it, or not at all
+void PaperExchange::hedge(unsigned long id, Side side, unsigned long price, unsigned long volume)
+{
+    unsigned long touch = (side == Side::BUY) ? mFutureBook.askPrices[0] : mFutureBook.bidPrices[0];
+    bool fills = touch != 0 && ((side == Side::BUY) ? touch <= price : touch >= price);
+    mEvents.push_back({PaperEventType::HEDGE_FILL, id, fills ? touch : 0, fills ? volume : 0, 0, 0});
+}
+
+//A book that moves through a resting order fills it at the order's price, as do trades at or through it
+void PaperExchange::onMarket(const MarketMessage& message)
+{
+    if ((Instrument)message.instrument == Instrument::FUTURE)
+    {
+        if (message.type == MarketMessageType::ORDER_BOOK)
+        {
+            mFutureBook = message;
+        }
+        return;
+    }
+
+    if (message.type == MarketMessageType::ORDER_BOOK)
+    {
+        mEtfBook = message;
+    }
+    for (PaperOrder& order : mOrders)
+    {
+        if (order.id == 0)
+        {
+            continue;
+        }
+        //ask side prices trade against sells, bid side prices against buys
+        const std::array<unsigned long, TOP_LEVEL_COUNT>& prices = (order.side == Side::BUY) ? message.bidPrices : message.askPrices;
+        const std::array<unsigned long, TOP_LEVEL_COUNT>& volumes = (order.side == Side::BUY) ? message.bidVolumes : message.askVolumes;
+        if (message.type == MarketMessageType::ORDER_BOOK)
+        {
+            //the book has moved through us: our buy is above the best ask (or our sell under the best bid)
+            const std::array<unsigned long, TOP_LEVEL_COUNT>& other = (order.side == Side::BUY) ? message.askPrices : message.bidPrices;
+            const std::array<unsigned long, TOP_LEVEL_COUNT>& otherVolumes = (order.side == Side::BUY) ? message.askVolumes : message.bidVolumes;
+            bool crossed = other[0] != 0 && ((order.side == Side::BUY) ? other[0] <= order.price : other[0] >= order.price);
+            if (crossed)
+            {
+                fill(order, order.price, std::min(otherVolumes[0], order.volume - order.filled), false);
+            }
+            continue;
+        }
+        unsigned long traded = 0;
+        for (std::size_t i = 0; i < TOP_LEVEL_COUNT && prices[i] != 0; i++)
+        {
+            bool through = (order.side == Side::BUY) ? prices[i] <= order.price : prices[i] >= order.price;
+            if (through)
+            {
+                traded += volumes[i];
+            }
+        }
+        if (traded != 0)
+        {
+            fill(order, order.price, std::min(traded, order.volume - order.filled), false);
+        }
+    }
+}
 
-            if(ETF_Much_Greater == true && ETF_Pos - std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]) > -100)
+//Hands every queued reply to the trader, including any caused by what it sent while handling them
+void PaperExchange::deliver(TraderCore& trader)
+{
+    while (!mEvents.empty())
+    {
+        mDelivering.swap(mEvents);
+        for (const PaperEvent& event : mDelivering)
+        {
+            if (event.type == PaperEventType::STATUS)
             {
-                //send a Ask/Sell order at the best bid
-                unsigned long tempID = mAskID;
-                SendInsertOrder(mAskID, Side::SELL, ETF_bestBid, std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_ETF_ask_arr.push_back(ETF_bestBid);
-                my_ETF_ask_ids.push_back(ETF_tempID)
-                my_ETF_ask_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Etf Ask/Sell Placed~~~~~~~~";  
-                positionLog();
-                //send a Buy order at the best ask for FTR
-                unsigned int tempID2 = mAskID;
-                SendHedgeOrder(mAskID, SIDE::BUY, FTR_bestAsk, std::min((unsigned long)LOT_SIZE, FTR_ask_vol_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_FTR_bid_arr.push_back(FTR_bestAsk);
-                my_FTR_ask_ids.push_back(tempID2);
-                my_FTR_bid_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, FTR_ask_vol_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Hedge Bid/Buy Placed~~~~~~~~";  
-                positionLog();
-                
-            } else if(FTR_Much_Greater == true && ETF_Pos + std::min((unsigned long)LOT_SIZE, ETF_bid_arr[0]) < 100)
+                trader.OrderStatusMessageHandler(event.id, event.volume, event.remaining, event.fees);
+            }
+            else if (event.type == PaperEventType::FILL)
+            {
+                trader.OrderFilledMessageHandler(event.id, event.price, event.volume);
+            }
+            else
             {
-                 //send an ETF Bid/Buy order at the best ask
-                unsigned long tempID = mAskID;
-                SendInsertOrder(mAskID, Side::BUY, ETF_bestAsk, std::min((unsigned long)LOT_SIZE, ETF_ask_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_ETF_bid_arr.push_back(ETF_bestAsk);
-                my_ETF_bid_ids.push_back(tempID);
-                my_etf_bid_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, ETF_ask_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Etf Ask/Sell Placed~~~~~~~~";  
-                positionLog();
-                //send a Ask/Sell order at the best bid for FTR
-                unsigned long tempID2 = mAskID;
-                SendHedgeOrder(mAskID, SIDE::SELL, FTR_bestBid, std::min((unsigned long)LOT_SIZE, FTR_bid_vol_arr[0]), Lifespan::GOOD_FOR_DAY);
-                //adding it to our order book at the price and quanity we ordered for 
-                my_FTR_ask_arr.push_back(FTR_bestBid);
-                my_FTR_ask_ids.push_back(tempID2);
-                my_FTR_ask_vol_arr.push_back(std::min((unsigned long)LOT_SIZE, FTR_bid_vol_arr[0]));
-                //log
-                RLOG(LG_AT, LogLevel::LL_INFO) << "\n~~~~~~~~After Hedge Bid/Buy Placed~~~~~~~~";  
-                positionLog();
+                trader.HedgeFilledMessageHandler(event.id, event.price, event.volume);
             }
         }
+        mDelivering.clear();
+    }
+}
+
+ShadowTrader::ShadowTrader(Factory factory, int cpu)
+    : mThread(&ShadowTrader::run, this, std::move(factory), cpu)
+{
+}
+
+ShadowTrader::~ShadowTrader()
+{
+    mStop = true;
+    mThread.join();
+}
+
+//Called from the live thread, never blocks
+bool ShadowTrader::publish(const MarketMessage& message)
+{
+    if (!mQueue.push(message))
+    {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+std::uint64_t ShadowTrader::dropped() const
+{
+    return mDropped.load(std::memory_order_relaxed);
+}
+
+//Builds the shadow trader here so everything it owns lives on this thread, then feeds it until stopped
+void ShadowTrader::run(Factory factory, int cpu)
+{
+    if (cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    boost::asio::io_context context;
+    PaperExchange paper;
+    std::unique_ptr<TraderCore> trader = factory(context);
+    trader->setPaperExchange(&paper);
+    RLOG(LG_AT, LogLevel::LL_INFO) << "shadow: started" << ((cpu >= 0) ? " on cpu " + std::to_string(cpu) : "");
+
+    MarketMessage message;
+    while (!mStop.load(std::memory_order_relaxed))
+    {
+        //poll() leaves the context stopped whenever it runs out of work, and the trader arms its timers again later
+        if (context.stopped())
+        {
+            context.restart();
+        }
+        bool idle = context.poll() == 0;
+        while (mQueue.pop(message))
+        {
+            idle = false;
+            paper.onMarket(message);
+            paper.deliver(*trader);
+            dispatchMarketMessage(*trader, message);
+            paper.deliver(*trader);
+        }
+        paper.deliver(*trader);
+        if (idle)
+        {
+            std::this_thread::yield();
+        }
     }
+    RLOG(LG_AT, LogLevel::LL_INFO) << "shadow: stopped, " << dropped() << " messages dropped";
 }
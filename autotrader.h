@@ -19,21 +19,579 @@
 #define CPPREADY_TRADER_GO_AUTOTRADER_H
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <mutex>
 #include <queue>
+#include <random>
 #include <memory>
 #include <string>
+#include <thread>
 #include <unordered_set>
+#include <vector>
 
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
 
 #include <ready_trader_go/baseautotrader.h>
 #include <ready_trader_go/types.h>
 
-class AutoTrader : public ReadyTraderGo::BaseAutoTrader
+//Client order ids carry their own routing, so handlers decode them instead of looking them up. Everything fits
+//in the 32 bits the exchange echoes back: bits 0-19 sequence, 20-22 quote level, 23-26 strategy slot, 27 side
+//(1 = BUY), 28 instrument (1 = ETF).
+struct OrderId
+{
+    static constexpr unsigned long SEQUENCE_BITS = 20;
+    static constexpr unsigned long LEVEL_SHIFT = 20;
+    static constexpr unsigned long SLOT_SHIFT = 23;
+    static constexpr unsigned long SIDE_SHIFT = 27;
+    static constexpr unsigned long INSTRUMENT_SHIFT = 28;
+
+    static constexpr unsigned long make(ReadyTraderGo::Instrument instrument, ReadyTraderGo::Side side,
+                                        unsigned long slot, unsigned long level, unsigned long sequence)
+    {
+        return ((unsigned long)(instrument == ReadyTraderGo::Instrument::ETF) << INSTRUMENT_SHIFT)
+               | ((unsigned long)(side == ReadyTraderGo::Side::BUY) << SIDE_SHIFT)
+               | ((slot & 0xf) << SLOT_SHIFT)
+               | ((level & 0x7) << LEVEL_SHIFT)
+               | (sequence & ((1ul << SEQUENCE_BITS) - 1));
+    }
+
+    static constexpr ReadyTraderGo::Instrument instrument(unsigned long id)
+    {
+        return ((id >> INSTRUMENT_SHIFT) & 1) ? ReadyTraderGo::Instrument::ETF : ReadyTraderGo::Instrument::FUTURE;
+    }
+
+    static constexpr ReadyTraderGo::Side side(unsigned long id)
+    {
+        return ((id >> SIDE_SHIFT) & 1) ? ReadyTraderGo::Side::BUY : ReadyTraderGo::Side::SELL;
+    }
+
+    static constexpr unsigned long slot(unsigned long id) { return (id >> SLOT_SHIFT) & 0xf; }
+
+    static constexpr std::size_t level(unsigned long id) { return (id >> LEVEL_SHIFT) & 0x7; }
+
+    static constexpr unsigned long sequence(unsigned long id) { return id & ((1ul << SEQUENCE_BITS) - 1); }
+};
+
+constexpr std::size_t HEDGE_SLOTS = 16;
+constexpr std::size_t STRATEGY_SLOTS = 4;       //strategies quoting side by side, each owns one OrderId slot
+constexpr std::size_t ORDER_RING_SIZE = 4096;
+constexpr std::size_t TIMER_WHEEL_SLOTS = 512;  //power of two, one slot per tick
+constexpr std::size_t TIMER_CAPACITY = 4096;    //timers that can be pending at once
+constexpr std::size_t TIMER_RESERVED = 512;     //of which markouts may never take the last few, trading depends on the rest
+
+enum class TimerKind : std::uint32_t
+{
+    NONE, QUOTE_EXPIRY, HEDGE_DEADLINE, HOUSEKEEPING, EXPOSURE_DEADLINE, MARKOUT
+};
+
+//Index + 1 in the low 32 bits and the node's generation in the high 32, so a handle to a timer that has fired
+//or been cancelled never matches a node that was reused. 0 = no timer.
+using TimerHandle = std::uint64_t;
+
+struct TimerNode
+{
+    std::uint64_t due = 0;          //tick it fires on
+    unsigned long arg = 0;          //order id for order timers
+    std::uint32_t next = 0;         //index + 1 in the slot or free list, 0 = end
+    std::uint32_t prev = 0;
+    std::uint32_t generation = 0;
+    TimerKind kind = TimerKind::NONE;
+};
+
+//Hashed timer wheel: a timer lives in slot due % TIMER_WHEEL_SLOTS and is skipped until its tick comes round, so
+//schedule and cancel are O(1) and the nodes come from a fixed pool instead of the heap
+class TimerWheel
+{
+public:
+    TimerWheel();
+
+    TimerHandle schedule(std::uint64_t delayTicks, TimerKind kind, unsigned long arg);
+
+    void cancel(TimerHandle handle);
+
+    bool expire(std::uint64_t nowTick, TimerKind& kind, unsigned long& arg);
+
+    void clear();
+
+    std::size_t size() const { return mActive; }
+
+private:
+    void unlink(std::uint32_t index);
+
+    std::array<TimerNode, TIMER_CAPACITY> mNodes{};
+    std::array<std::uint32_t, TIMER_WHEEL_SLOTS> mSlots{};  //head of each slot, index + 1
+    std::uint32_t mFree = 0;                                //head of the free list, index + 1
+    std::uint64_t mTick = 0;                                //next tick to expire
+    std::size_t mActive = 0;
+};
+
+struct PendingHedge
+{
+    unsigned long id = 0;       //0 = free
+    signed long lots = 0;       //signed FUTURE lots requested (positive = buying)
+    std::int64_t sentAt = 0;    //steady clock ns
+    TimerHandle deadline = 0;
+    bool expired = false;       //missed its deadline, lots no longer counted in flight
+};
+
+//Hedge orders that have been sent but not yet reported back, netted so one order covers many fills
+struct HedgeManager
+{
+    signed long inFlight = 0;                          //signed FUTURE lots in flight (positive = buying)
+    std::array<PendingHedge, HEDGE_SLOTS> pending{};   //by sequence % HEDGE_SLOTS
+    bool flushScheduled = false;
+};
+
+//Tracks how long the ETF and FUTURE positions have been further apart than the exchange allows
+struct ExposureWatchdog
+{
+    bool breached = false;
+    std::int64_t breachedAt = 0;  //steady clock ns when the limit was crossed
+    TimerHandle deadline = 0;     //forced hedge
+};
+
+//What we keep per ETF order beyond its quote slot, by sequence % ORDER_RING_SIZE
+struct OrderRecord
+{
+    unsigned long id = 0;
+    signed long fees = 0;       //fees booked so far
+    std::int64_t sentAt = 0;    //steady clock ns when inserted
+    bool acked = false;
+    bool filled = false;
+};
+
+//An ETF order we are keeping on the book
+struct LiveQuote
+{
+    unsigned long id = 0;      //0 = nothing live
+    unsigned long price = 0;
+    unsigned long volume = 0;  //total volume as inserted/amended
+    unsigned long filled = 0;
+    TimerHandle expiry = 0;
+};
+
+//At most one live ETF order per side per level
+struct QuoteManager
+{
+    using Levels = std::array<LiveQuote, ReadyTraderGo::TOP_LEVEL_COUNT>;
+    Levels asks;
+    Levels bids;
+};
+
+//A price and volume we want resting, volume 0 = nothing at this level
+struct QuoteTarget
+{
+    unsigned long price = 0;
+    unsigned long volume = 0;
+};
+
+using Ladder = std::array<QuoteTarget, ReadyTraderGo::TOP_LEVEL_COUNT>;
+
+using QuoteBook = std::array<QuoteManager, STRATEGY_SLOTS>;
+
+//What is left for the strategy slots still to be gated, shared so they cannot add up past the limits or trade
+//with each other
+struct RiskBudget
+{
+    unsigned long askRoom = 0;      //lots that may still rest on the ask
+    unsigned long bidRoom = 0;
+    unsigned long lowestAsk = 0;    //of the ladders already gated, 0 = none
+    unsigned long highestBid = 0;
+};
+
+//Running position, cash and fees for one instrument, all in cents
+struct InstrumentPnL
+{
+    signed long position = 0;
+    signed long cash = 0;       //sells add, buys subtract
+    signed long fees = 0;       //positive = paid
+    signed long realised = 0;
+    double avgCost = 0;         //average price of the open position
+
+    void onFill(signed long signedVolume, unsigned long price);
+
+    signed long markToMarket(unsigned long midprice) const;
+};
+
+struct PnLEngine
+{
+    InstrumentPnL etf;
+    InstrumentPnL future;
+};
+
+constexpr std::size_t FLIGHT_RECORDER_SIZE = 8192;
+constexpr unsigned long FLIGHT_DUMP_FILES = 16; //dump file names are reused after this many
+
+enum class FlightEvent : std::uint32_t
+{
+    BOOK, TRADE_TICKS, SIGNAL, INSERT, AMEND, CANCEL, HEDGE, FILL, HEDGE_FILL, STATUS, ERROR, DISCONNECT
+};
+
+//One event as written to disk, id is the order id (or sequence number for market data), a/b/c depend on the event
+struct FlightRecord
+{
+    std::int64_t time = 0;  //steady clock ticks
+    FlightEvent event = FlightEvent::BOOK;
+    std::uint32_t pad = 0;
+    std::uint64_t id = 0;
+    std::uint64_t a = 0;
+    std::uint64_t b = 0;
+    std::uint64_t c = 0;
+};
+
+//Always-on ring of the last FLIGHT_RECORDER_SIZE events, dumped to disk when something goes wrong
+class FlightRecorder
+{
+public:
+    ~FlightRecorder();
+
+    void record(FlightEvent event, unsigned long id, unsigned long a, unsigned long b, unsigned long c);
+
+    void dump(const std::string& reason, int minIntervalMs = 0);
+
+    void wait();
+
+    void touch();
+
+    void clear();
+
+    void setPrefix(const std::string& prefix);
+
+private:
+    std::array<FlightRecord, FLIGHT_RECORDER_SIZE> mRecords;
+    std::string mPrefix = "autotrader_flight_";
+    std::size_t mNext = 0;
+    unsigned long mDumps = 0;
+    std::int64_t mLastDump = 0; //steady clock ns, 0 = never
+    std::thread mWriter; //the last dump's writer, joined before the next one starts
+};
+
+constexpr std::size_t TRADE_FLOW_WINDOW = 64; //trade ticks messages in the rolling window
+
+//Totals from one trade ticks message
+struct TradeSample
+{
+    unsigned long buyVolume = 0;
+    unsigned long sellVolume = 0;
+    unsigned long notional = 0;
+};
+
+//Rolling VWAP, signed volume and aggressor imbalance for one instrument, kept apart from the order book
+class TradeFlow
+{
+public:
+    void onTicks(const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askPrices,
+                 const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askVolumes,
+                 const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidPrices,
+                 const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidVolumes,
+                 unsigned long bestAsk,
+                 unsigned long bestBid);
+
+    unsigned long vwap() const;
+
+    signed long signedVolume() const;
+
+    double imbalance() const;
+
+    unsigned long tradeThroughs = 0;
+    signed int lastTradeThrough = 0; //1 = through the best ask, -1 = through the best bid
+
+private:
+    std::array<TradeSample, TRADE_FLOW_WINDOW> mSamples{};
+    std::size_t mNext = 0;
+    unsigned long mBuyVolume = 0;
+    unsigned long mSellVolume = 0;
+    unsigned long mNotional = 0;
+};
+
+constexpr std::size_t SIGNAL_HORIZONS = 4;
+
+//EWMA mean and variance of the ETF-FUTURE spread at several half-lives, no history kept
+class SignalBank
+{
+public:
+    explicit SignalBank(const std::array<double, SIGNAL_HORIZONS>& halfLives);
+
+    void update(double x);
+
+    double zScore(std::size_t horizon) const;
+
+    double mean(std::size_t horizon) const;
+
+    unsigned long count() const;
+
+private:
+    std::array<double, SIGNAL_HORIZONS> mAlpha{};
+    std::array<double, SIGNAL_HORIZONS> mMean{};
+    std::array<double, SIGNAL_HORIZONS> mVariance{};
+    double mLast = 0;
+    unsigned long mCount = 0;
+};
+
+constexpr std::size_t MARKOUT_HORIZONS = 3;
+constexpr std::size_t MARKOUT_CAPACITY = 1024; //fills still waiting on a horizon, older ones are overwritten
+
+//A fill waiting for its markouts
+struct MarkoutFill
+{
+    std::uint64_t fill = 0;     //which fill this slot holds
+    ReadyTraderGo::Side side = ReadyTraderGo::Side::BUY;
+    unsigned long price = 0;
+    unsigned long volume = 0;
+};
+
+//Volume weighted markout in cents per lot, positive = the mid moved our way after the fill
+struct MarkoutStats
+{
+    unsigned long fills = 0;
+    unsigned long volume = 0;
+    double sum = 0;
+    double sumSquares = 0;
+
+    double mean() const { return (volume == 0) ? 0.0 : sum / volume; }
+};
+
+//Fill prices against the ETF midprice at fixed horizons after the fill, kept in a fixed ring so it can run all session
+class MarkoutEngine
+{
+public:
+    std::uint64_t record(ReadyTraderGo::Side side, unsigned long price, unsigned long volume);
+
+    void sample(std::uint64_t key, unsigned long midprice);
+
+    const MarkoutStats& stats(ReadyTraderGo::Side side, std::size_t horizon) const;
+
+private:
+    std::array<MarkoutFill, MARKOUT_CAPACITY> mFills{};
+    std::array<std::array<MarkoutStats, MARKOUT_HORIZONS>, 2> mStats{};  //by side (0 = SELL)
+    std::uint64_t mNextFill = 1;
+};
+
+//Everything needed to resume trading after a restart, laid out as-is in a memory-mapped file
+struct Checkpoint
+{
+    std::uint64_t magic = 0;
+    std::uint64_t version = 0;  //odd while a snapshot is being written
+    std::int64_t savedAt = 0;   //wall clock, ns since the epoch
+    unsigned long nextMessageId = 0;
+    signed long etfPosition = 0;
+    signed long futurePosition = 0;
+    std::array<signed long, STRATEGY_SLOTS> slotPositions{};
+    PnLEngine pnl;
+    SignalBank signals{{1, 1, 1, 1}};
+    QuoteBook quotes;
+};
+
+struct perf_event_mmap_page;
+
+enum class PerfHandler : std::size_t
+{
+    ORDER_BOOK, TRADE_TICKS, ORDER_FILLED, HEDGE_FILLED
+};
+
+constexpr std::size_t PERF_HANDLERS = 4;
+constexpr std::size_t PERF_COUNTERS = 4; //cycles, instructions, cache misses, branch misses
+
+using PerfSample = std::array<std::uint64_t, PERF_COUNTERS>;
+
+//Hardware counters for this thread read in user space with rdpmc, totalled per handler
+class PerfCounters
+{
+public:
+    bool open();
+
+    void close();
+
+    bool enabled() const { return mEnabled; }
+
+    PerfSample read() const;
+
+    void add(PerfHandler handler, const PerfSample& start);
+
+    void reset();
+
+    void report() const;
+
+private:
+    std::uint64_t readCounter(std::size_t i) const;
+
+    bool mEnabled = false;
+    std::array<int, PERF_COUNTERS> mFds{-1, -1, -1, -1};
+    std::array<perf_event_mmap_page*, PERF_COUNTERS> mPages{};
+    std::array<PerfSample, PERF_HANDLERS> mTotals{};
+    std::array<std::uint64_t, PERF_HANDLERS> mCalls{};
+};
+
+//Counts the events between construction and destruction against one handler, a no-op when counters are off
+class PerfScope
+{
+public:
+    PerfScope(PerfCounters& counters, PerfHandler handler);
+
+    ~PerfScope();
+
+private:
+    PerfCounters& mCounters;
+    PerfHandler mHandler;
+    PerfSample mStart{};
+};
+
+enum class MetricHandler : std::size_t
+{
+    ORDER_BOOK, TRADE_TICKS, ORDER_FILLED, HEDGE_FILLED, ORDER_STATUS, ERROR
+};
+
+enum class MetricCounter : std::size_t
+{
+    INSERTS, AMENDS, CANCELS, HEDGES, REJECTS, HEDGE_FILLS, HEDGE_LOTS, FORCED_HEDGES, TIMER_FAILURES, SHADOW_DROPS,
+    JOURNAL_DROPS
+};
+
+enum class MetricGauge : std::size_t
+{
+    ETF_POSITION, FUTURE_POSITION, PNL
+};
+
+//Order round trips measured from the insert (or hedge) being sent
+enum class RoundTrip : std::size_t
+{
+    ETF_SELL_ACK, ETF_BUY_ACK, ETF_SELL_FILL, ETF_BUY_FILL, HEDGE_SELL_FILL, HEDGE_BUY_FILL
+};
+
+constexpr std::size_t ROUND_TRIP_STAGES = 6;
+constexpr std::size_t METRIC_HANDLERS = 6;
+constexpr std::size_t METRIC_COUNTERS = 11;
+constexpr std::size_t METRIC_GAUGES = 3;
+constexpr std::size_t LATENCY_BUCKETS = 40; //power of two nanosecond buckets
+
+using LatencyHistogram = std::array<std::atomic<std::uint64_t>, LATENCY_BUCKETS>;
+
+//Counters, gauges and latency histograms updated from the trading thread with relaxed atomics, written out as
+//Prometheus text by a background thread
+class MetricsRegistry
+{
+public:
+    ~MetricsRegistry();
+
+    void start(const std::string& fileName);
+
+    void reset();
+
+    void add(MetricCounter counter, std::uint64_t amount = 1)
+    {
+        mCounters[(std::size_t)counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    void set(MetricGauge gauge, std::int64_t value)
+    {
+        mGauges[(std::size_t)gauge].store(value, std::memory_order_relaxed);
+    }
+
+    void recordMessage(MetricHandler handler, std::uint64_t nanoseconds);
+
+    void recordRoundTrip(RoundTrip stage, std::uint64_t nanoseconds);
+
+private:
+    void write(const std::string& fileName) const;
+
+    std::array<std::atomic<std::uint64_t>, METRIC_COUNTERS> mCounters{};
+    std::array<std::atomic<std::int64_t>, METRIC_GAUGES> mGauges{};
+    std::array<std::atomic<std::uint64_t>, METRIC_HANDLERS> mMessages{};
+    std::array<LatencyHistogram, METRIC_HANDLERS> mLatency{};
+    std::array<LatencyHistogram, ROUND_TRIP_STAGES> mRoundTrip{};
+    std::thread mWriter;
+    std::mutex mStopMutex;
+    std::condition_variable mStopSignal;
+    bool mStop = false;
+};
+
+//Counts one message for a handler and records how long it took
+class MetricsScope
+{
+public:
+    MetricsScope(MetricsRegistry& registry, MetricHandler handler);
+
+    ~MetricsScope();
+
+private:
+    MetricsRegistry& mRegistry;
+    MetricHandler mHandler;
+    std::chrono::steady_clock::time_point mStart;
+};
+
+enum class MarketMessageType : std::uint32_t
+{
+    ORDER_BOOK, TRADE_TICKS
+};
+
+//One order book or trade ticks message, also the fixed size record of a journal file
+struct MarketMessage
+{
+    MarketMessageType type = MarketMessageType::ORDER_BOOK;
+    std::uint32_t instrument = 0;
+    std::uint64_t sequence = 0;
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> askPrices{};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> askVolumes{};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> bidPrices{};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> bidVolumes{};
+};
+
+//LIVE trades on the exchange. SHADOW paper trades: no checkpoint, its own metrics file, and orders go to a PaperExchange.
+//BENCHMARK replays journals with neither a checkpoint nor a metrics file, so it never touches a live trader's files.
+enum class TraderMode
+{
+    LIVE, SHADOW, BENCHMARK
+};
+
+class JournalRecorder;
+class PaperExchange;
+class ShadowTrader;
+class TraderCore;
+
+//Builds a trader on the io_context it is given, used to start one on another thread
+using TraderFactory = std::function<std::unique_ptr<TraderCore>(boost::asio::io_context&)>;
+
+//What the policies get to see when deciding, built once per decision from the core's state
+struct MarketView
+{
+    const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& etfAskPrices;
+    const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& etfAskVolumes;
+    const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& etfBidPrices;
+    const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& etfBidVolumes;
+    unsigned long etfBestAsk;
+    unsigned long etfBestBid;
+    unsigned long etfMidprice;
+    unsigned long futureMidprice;
+    unsigned long fairValue;        //0 until the future has a price
+    const SignalBank& signals;
+    const TradeFlow& etfFlow;
+    const TradeFlow& futureFlow;
+    signed long etfPosition;
+    signed long futurePosition;
+    signed long pnl;                //marked to market, cents
+};
+
+//What an order book message changed
+struct BookUpdate
+{
+    bool changed = false;       //something the decision reads moved and both books have prices
+    bool midChanged = false;    //and the signals were updated
+};
+
+//Connection, order and position bookkeeping with no trading decisions in it. Market data and fills are taken in by
+//the on* calls and StrategyHost decides what to do with them.
+class TraderCore : public ReadyTraderGo::BaseAutoTrader
 {
 public:
-    explicit AutoTrader(boost::asio::io_context& context);
+    explicit TraderCore(boost::asio::io_context& context, TraderMode mode = TraderMode::LIVE);
+
+    ~TraderCore() override;
 
     // Called when the execution connection is lost.
     void DisconnectHandler() override;
@@ -44,6 +602,282 @@ public:
     void ErrorMessageHandler(unsigned long clientOrderId,
                              const std::string& errorMessage) override;
 
+    // Called when the status of one of your orders changes.
+    // The fill volume is the number of lots already traded, remaining volume
+    // is the number of lots yet to be traded and fees is the total fees paid
+    // or received for this order.
+    // Remaining volume will be set to zero if the order is cancelled.
+    void OrderStatusMessageHandler(unsigned long clientOrderId,
+                                   unsigned long fillVolume,
+                                   unsigned long remainingVolume,
+                                   signed long fees) override;
+
+    void setOffline(bool offline);
+
+    TraderMode mode() const;
+
+    void setPaperExchange(PaperExchange* paper);
+
+    void setShadow(ShadowTrader* shadow);
+
+protected:
+    BookUpdate onOrderBook(ReadyTraderGo::Instrument instrument,
+                           unsigned long sequenceNumber,
+                           const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askPrices,
+                           const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askVolumes,
+                           const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidPrices,
+                           const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidVolumes);
+
+    void onTradeTicks(ReadyTraderGo::Instrument instrument,
+                      unsigned long sequenceNumber,
+                      const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askPrices,
+                      const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askVolumes,
+                      const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidPrices,
+                      const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidVolumes);
+
+    bool onOrderFilled(unsigned long clientOrderId, unsigned long price, unsigned long volume);
+
+    bool onHedgeFilled(unsigned long clientOrderId, unsigned long price, unsigned long volume);
+
+    MarketView marketView() const;
+
+    signed long slotPosition(std::size_t slot) const;
+
+    void start();
+
+    void startShadow(const TraderFactory& factory);
+
+    void startJournal();
+
+    void publishMarket(MarketMessageType type,
+                       ReadyTraderGo::Instrument instrument,
+                       unsigned long sequenceNumber,
+                       const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askPrices,
+                       const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askVolumes,
+                       const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidPrices,
+                       const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidVolumes);
+
+    void sendInsert(unsigned long id, ReadyTraderGo::Side side, unsigned long price, unsigned long volume);
+
+    void sendAmend(unsigned long id, unsigned long volume);
+
+    void sendCancel(unsigned long id);
+
+    void sendHedge(unsigned long id, ReadyTraderGo::Side side, unsigned long price, unsigned long volume);
+
+    void positionLog();
+
+    void openCheckpoint();
+
+    void saveCheckpoint();
+
+    void captureState(Checkpoint& checkpoint) const;
+
+    void restoreCheckpoint(const Checkpoint& checkpoint);
+
+    void reconcileRestoredOrders();
+
+    void scheduleCheckpoint();
+
+    void warmUp();
+
+    signed long totalPnL() const;
+
+    unsigned long fairValue() const;
+
+    void applyLadder(std::size_t slot, ReadyTraderGo::Side side, const Ladder& desired);
+
+    void gateLadder(std::size_t slot, RiskBudget& budget, Ladder& asks, Ladder& bids) const;
+
+    void updateQuote(std::size_t slot, ReadyTraderGo::Side side, std::size_t level, unsigned long price,
+                     unsigned long volume);
+
+    LiveQuote* findQuote(unsigned long clientOrderId);
+
+    unsigned long nextSequence();
+
+    OrderRecord& orderRecord(unsigned long clientOrderId);
+
+    signed long unhedgedLots() const;
+
+    void scheduleHedge(int batchWindowMs);
+
+    void flushHedges();
+
+    void checkExposure();
+
+    TimerHandle scheduleTimer(int delayMs, TimerKind kind, unsigned long arg);
+
+    void scheduleTimerTick();
+
+    void onTimer(TimerKind kind, unsigned long arg);
+
+    TraderMode mMode;
+    PaperExchange* mPaper = nullptr;    //SHADOW: where orders go instead of the exchange
+    ShadowTrader* mShadow = nullptr;    //LIVE: gets a copy of every market data message
+    std::unique_ptr<ShadowTrader> mOwnedShadow; //the one startShadow made, if any
+    std::unique_ptr<JournalRecorder> mJournal; //LIVE with ENABLE_JOURNAL: records the feed for replay
+    unsigned long mNextMessageId = 1; //sequence part of the next order id
+    QuoteBook mQuotes;
+    std::array<signed long, STRATEGY_SLOTS> mSlotPositions{};
+    HedgeManager mHedges;
+    ExposureWatchdog mWatchdog;
+    PnLEngine mPnL;
+    std::array<OrderRecord, ORDER_RING_SIZE> mOrders{};
+    FlightRecorder mFlight;
+    PerfCounters mPerf;
+    MetricsRegistry mMetrics;
+    TimerWheel mTimers;
+    boost::asio::steady_timer mHedgeTimer;
+    boost::asio::steady_timer mWheelTimer;
+    std::chrono::steady_clock::time_point mWheelStart;
+    Checkpoint* mCheckpoint = nullptr; //mapped for the life of the process
+    bool mReconcilePending = false;
+    std::int64_t mLastBook = 0; //steady clock ns of the last order book, every one either re-runs or confirms the ladders
+    bool mOffline = false; //handlers run but nothing is sent (warm-up, synthetic and replayed sessions)
+    std::size_t mBookDepth = ReadyTraderGo::TOP_LEVEL_COUNT; //ETF price levels compared for changes, set by the host
+    //+==============================+
+    signed long ETF_Pos = 0;
+    signed long FTR_Pos = 0;
+    unsigned long ETF_bestAsk = 0;
+    unsigned long ETF_bestBid = 0;
+    unsigned long ETF_midprice = 0;
+    unsigned long FTR_bestAsk = 0;
+    unsigned long FTR_bestBid = 0;
+    unsigned long FTR_midprice = 0;
+    //map containing OrderID's and their price
+    //std::map<unsigned long, unsigned long> ETF_Sells_To_Hedge;
+    //std::map<unsigned long, unsigned long> ETF_Buys_To_Hedge;
+    SignalBank mSignals;
+    MarkoutEngine mMarkouts;
+    //market info
+    TradeFlow ETF_flow;
+    TradeFlow FTR_flow;
+    bool FTR_flowChanged = false; //trade ticks moved fair value since the last book update
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> ETF_ask_arr{};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> ETF_ask_vol_arr{};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> ETF_bid_arr{};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> ETF_bid_vol_arr{};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> FTR_ask_arr{};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> FTR_ask_vol_arr{};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> FTR_bid_arr{};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> FTR_bid_vol_arr{};
+};
+
+//What tells SpreadSignalStrategy variants apart
+struct SpreadSignalConfig
+{
+    std::size_t horizon = 0;        //SignalBank horizon the entry decision reads
+    double threshold = 0;           //z-score needed to call one instrument much greater
+    double exitThreshold = 0;       //z-score the position is held down to, below threshold so noise cannot flip it
+    unsigned long lotSize = 0;      //per order
+    unsigned long targetLots = 0;   //ETF position taken at the threshold, short when the ETF is much greater
+    std::size_t ladderLevels = 0;   //passive quotes per side, the signal order takes one more level
+};
+
+//Where SpreadSignalStrategy stands on the spread. Entered when the z-score crosses the threshold, held while it stays
+//past the exit threshold, then flat again
+enum class SpreadState
+{
+    FLAT, SHORT_ETF, LONG_ETF
+};
+
+//Default strategy: works the ETF towards a target position set by the ETF-FUTURE z-score, taking the cheap side when
+//the spread is extreme and unwinding as it reverts, and always quotes a passive ladder around fair value. The signal
+//order is only repriced when the target moves or inventory grows, so a signal that stays on sends nothing new
+class SpreadSignalStrategy
+{
+public:
+    SpreadSignalStrategy();
+
+    explicit SpreadSignalStrategy(const SpreadSignalConfig& config);
+
+    static SpreadSignalConfig defaultConfig();
+
+    void onSignal(const MarketView& view);
+
+    void decide(const MarketView& view, signed long position, unsigned long askRoom, unsigned long bidRoom,
+                Ladder& asks, Ladder& bids);
+
+    int signal() const;
+
+    signed long target() const;
+
+    std::size_t bookDepth() const;
+
+private:
+    signed long targetFor(double z) const;
+
+    SpreadSignalConfig mConfig;
+    SpreadState mState = SpreadState::FLAT;
+    signed long mTarget = 0;        //ETF position wanted, 0 when flat
+    signed long mArmedGap = 0;      //target - position at the last decision
+    unsigned long mTakePrice = 0;   //touch price when the signal order was last priced, it stays there
+    bool mRearm = false;            //target moved since
+};
+
+//Default risk: quotes never take the ETF past the position limit and everything is pulled past the loss limit
+class LossLimitRisk
+{
+public:
+    bool allowTrading(const MarketView& view) const;
+
+    unsigned long askRoom(const MarketView& view) const;
+
+    unsigned long bidRoom(const MarketView& view) const;
+};
+
+//Default hedging: fills arriving within a short window are netted into one hedge order
+class BatchedHedging
+{
+public:
+    int batchWindowMs(signed long unhedgedLots) const;
+};
+
+//Puts a strategy, a risk policy and a hedging policy on top of TraderCore. Policies are plain classes fixed at compile
+//time, so from a handler down to the ladder every call is direct and can be inlined. Variants copies of the strategy
+//(say with different thresholds) can run off the one feed: each quotes from its own OrderId slot, sees the same
+//MarketView, and is gated in slot order through one RiskBudget so together they stay inside the risk policy's room.
+//
+//  Strategy:    void onSignal(const MarketView&)                       the spread signals were just updated
+//               void decide(const MarketView&, position, askRoom, bidRoom, Ladder& asks, Ladder& bids)
+//                                                                      position is what this variant's fills built
+//               int signal() const                                     1 = sell ETF, -1 = buy ETF, 0 = none
+//               std::size_t bookDepth() const                          ETF price levels decide() reads
+//  RiskPolicy:  bool allowTrading(const MarketView&) const             false pulls every quote
+//               unsigned long askRoom/bidRoom(const MarketView&) const lots that may still be sold/bought
+//  HedgePolicy: int batchWindowMs(signed long unhedgedLots) const      0 = hedge straight away
+template <typename Strategy, typename RiskPolicy, typename HedgePolicy, std::size_t Variants = 1>
+class StrategyHost : public TraderCore
+{
+    static_assert(Variants >= 1 && Variants <= STRATEGY_SLOTS, "every strategy variant needs its own slot");
+
+public:
+    explicit StrategyHost(boost::asio::io_context& context,
+                          const std::array<Strategy, Variants>& strategies = std::array<Strategy, Variants>(),
+                          const RiskPolicy& risk = RiskPolicy(), const HedgePolicy& hedging = HedgePolicy(),
+                          TraderMode mode = TraderMode::LIVE)
+        : TraderCore(context, mode), mStrategies(strategies), mRisk(risk), mHedging(hedging)
+    {
+        //book updates beyond the deepest level any variant reads are not worth a decision
+        mBookDepth = 1;
+        for (const Strategy& strategy : mStrategies)
+        {
+            mBookDepth = std::max(mBookDepth, std::min(strategy.bookDepth(), ReadyTraderGo::TOP_LEVEL_COUNT));
+        }
+        start();
+        //warm-up ran the policies over synthetic data, put them back as configured
+        mStrategies = strategies;
+        mRisk = risk;
+        mHedging = hedging;
+        //with ENABLE_SHADOW_TRADER on, a copy configured the same way paper trades off this one's feed
+        startShadow([strategies, risk, hedging](boost::asio::io_context& shadowContext)
+        {
+            return std::unique_ptr<TraderCore>(new StrategyHost(shadowContext, strategies, risk, hedging,
+                                                                TraderMode::SHADOW));
+        });
+    }
+
     // Called when one of your hedge orders is filled, partially or fully.
     //
     // The price is the average price at which the order was (partially) filled,
@@ -53,7 +887,15 @@ public:
     // If the order was unsuccessful, both the price and volume will be zero.
     void HedgeFilledMessageHandler(unsigned long clientOrderId,
                                    unsigned long price,
-                                   unsigned long volume) override;
+                                   unsigned long volume) override
+    {
+        PerfScope perf(mPerf, PerfHandler::HEDGE_FILLED);
+        MetricsScope metrics(mMetrics, MetricHandler::HEDGE_FILLED);
+        if (onHedgeFilled(clientOrderId, price, volume))
+        {
+            scheduleHedge(mHedging.batchWindowMs(unhedgedLots()));
+        }
+    }
 
     // Called periodically to report the status of an order book.
     // The sequence number can be used to detect missed or out-of-order
@@ -65,22 +907,40 @@ public:
                                  const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askPrices,
                                  const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askVolumes,
                                  const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidPrices,
-                                 const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidVolumes) override;
+                                 const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidVolumes) override
+    {
+        PerfScope perf(mPerf, PerfHandler::ORDER_BOOK);
+        MetricsScope metrics(mMetrics, MetricHandler::ORDER_BOOK);
+        BookUpdate update = onOrderBook(instrument, sequenceNumber, askPrices, askVolumes, bidPrices, bidVolumes);
+        if (update.changed)
+        {
+            positionLog();
+            MarketView view = marketView();
+            if (update.midChanged)
+            {
+                for (Strategy& strategy : mStrategies)
+                {
+                    strategy.onSignal(view);
+                }
+            }
+            trade(view);
+        }
+        publishMarket(MarketMessageType::ORDER_BOOK, instrument, sequenceNumber, askPrices, askVolumes, bidPrices,
+                      bidVolumes);
+    }
 
     // Called when one of your orders is filled, partially or fully.
     void OrderFilledMessageHandler(unsigned long clientOrderId,
                                    unsigned long price,
-                                   unsigned long volume) override;
-
-    // Called when the status of one of your orders changes.
-    // The fill volume is the number of lots already traded, remaining volume
-    // is the number of lots yet to be traded and fees is the total fees paid
-    // or received for this order.
-    // Remaining volume will be set to zero if the order is cancelled.
-    void OrderStatusMessageHandler(unsigned long clientOrderId,
-                                   unsigned long fillVolume,
-                                   unsigned long remainingVolume,
-                                   signed long fees) override;
+                                   unsigned long volume) override
+    {
+        PerfScope perf(mPerf, PerfHandler::ORDER_FILLED);
+        MetricsScope metrics(mMetrics, MetricHandler::ORDER_FILLED);
+        if (onOrderFilled(clientOrderId, price, volume))
+        {
+            scheduleHedge(mHedging.batchWindowMs(unhedgedLots()));
+        }
+    }
 
     // Called periodically when there is trading activity on the market.
     // The five best ask (i.e. sell) and bid (i.e. buy) prices at which there
@@ -93,61 +953,275 @@ public:
                                   const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askPrices,
                                   const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& askVolumes,
                                   const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidPrices,
-                                  const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidVolumes) override;
+                                  const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidVolumes) override
+    {
+        PerfScope perf(mPerf, PerfHandler::TRADE_TICKS);
+        MetricsScope metrics(mMetrics, MetricHandler::TRADE_TICKS);
+        onTradeTicks(instrument, sequenceNumber, askPrices, askVolumes, bidPrices, bidVolumes);
+        publishMarket(MarketMessageType::TRADE_TICKS, instrument, sequenceNumber, askPrices, askVolumes, bidPrices,
+                      bidVolumes);
+    }
 
-    void positionLog();
+private:
+    //Builds the ETF ladder each strategy wants inside what risk allows and sends only the differences
+    void trade(const MarketView& view)
+    {
+        mMetrics.set(MetricGauge::PNL, view.pnl);
 
-    void deterMineOrderStatus(std::queue<unsigned long> DIFF_recent_mp_prices);
+        //once risk says stop nothing new goes out and everything resting is pulled
+        bool allowed = mRisk.allowTrading(view);
+        RiskBudget budget;
+        if (allowed)
+        {
+            budget.askRoom = mRisk.askRoom(view);
+            budget.bidRoom = mRisk.bidRoom(view);
+        }
 
+        for (std::size_t slot = 0; slot < Variants; slot++)
+        {
+            Ladder asks{};
+            Ladder bids{};
+            int signal = mStrategies[slot].signal();
+            mFlight.record(FlightEvent::SIGNAL, slot, signal > 0, signal < 0, view.fairValue);
+            if (allowed)
+            {
+                mStrategies[slot].decide(view, slotPosition(slot), budget.askRoom, budget.bidRoom, asks, bids);
+                gateLadder(slot, budget, asks, bids);
+            }
+            applyLadder(slot, ReadyTraderGo::Side::SELL, asks);
+            applyLadder(slot, ReadyTraderGo::Side::BUY, bids);
+        }
+    }
+
+    std::array<Strategy, Variants> mStrategies;
+    RiskPolicy mRisk;
+    HedgePolicy mHedging;
+};
+
+using AutoTrader = StrategyHost<SpreadSignalStrategy, LossLimitRisk, BatchedHedging>;
+
+void dispatchMarketMessage(TraderCore& trader, const MarketMessage& message);
+
+//Single producer single consumer ring, the producer never waits: push fails when the ring is full
+template <typename T, std::size_t N>
+class SpscQueue
+{
+    static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+    bool push(const T& item)
+    {
+        std::size_t head = mHead.load(std::memory_order_relaxed);
+        if (head - mTailCache == N)
+        {
+            mTailCache = mTail.load(std::memory_order_acquire);
+            if (head - mTailCache == N)
+            {
+                return false;
+            }
+        }
+        mItems[head & (N - 1)] = item;
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        std::size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail == mHeadCache)
+        {
+            mHeadCache = mHead.load(std::memory_order_acquire);
+            if (tail == mHeadCache)
+            {
+                return false;
+            }
+        }
+        item = mItems[tail & (N - 1)];
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
 
 private:
-    unsigned long mNextMessageId = 1;
-    unsigned long mAskId = 0;
-    unsigned long mAskPrice = 0;
-    unsigned long mBidId = 0;
-    unsigned long mBidPrice = 0;
-    signed long mPosition = 0;
-    std::unordered_set<unsigned long> mAsks;
-    std::unordered_set<unsigned long> mBids;
-    //+==============================+
-    bool ETF_Much_Greater = false;
-    bool FTR_Much_Greater = false;
-    signed long ETF_Pos = 0;
-    signed long FTR_Pos = 0;
-    unsigned long ETF_bestAsk = 0;
-    unsigned long ETF_bestBid = 0;
-    unsigned long ETF_midprice = 0;
-    unsigned long FTR_bestAsk = 0;
-    unsigned long FTR_bestBid = 0;
-    unsigned long FTR_midprice = 0;
-    //map containing OrderID's and their price
-    //std::map<unsigned long, unsigned long> ETF_Sells_To_Hedge;
-    //std::map<unsigned long, unsigned long> ETF_Buys_To_Hedge;
-    std::queue<unsigned long> ETF_recent_mp_prices;
-    std::queue<unsigned long> FTR_recent_mp_prices;
-    std::queue<unsigned long> DIFF_recent_mp_prices;
-    //my info
-    std::vector<std::vector<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>> my_ETF_ask_arr; //0 = price, 1 = volume, 2 = ids, 3 = time?
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> my_ETF_ask_ids;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> my_ETF_ask_vol_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> my_ETF_bid_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> my_ETF_bid_ids;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> my_ETF_bid_vol_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> my_FTR_ask_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> my_FTR_ask_ids;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> my_FTR_ask_vol_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> my_FTR_bid_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> my_FTR_bid_ids;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> my_FTR_bid_vol_arr;
-    //market info
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> ETF_ask_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> ETF_ask_vol_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> ETF_bid_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> ETF_bid_vol_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> FTR_ask_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> FTR_ask_vol_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> FTR_bid_arr;
-    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> FTR_bid_vol_arr;
+    //producer and consumer each keep a stale copy of the other's index so most calls touch only their own line
+    alignas(64) std::atomic<std::size_t> mHead{0};
+    std::size_t mTailCache = 0;
+    alignas(64) std::atomic<std::size_t> mTail{0};
+    std::size_t mHeadCache = 0;
+    alignas(64) std::array<T, N> mItems{};
+};
+
+constexpr std::size_t PAPER_ORDERS = 64;
+constexpr std::size_t SHADOW_QUEUE_SIZE = 4096;
+constexpr std::size_t JOURNAL_QUEUE_SIZE = 4096;
+
+//One of the shadow trader's orders resting in the paper exchange
+struct PaperOrder
+{
+    unsigned long id = 0;       //0 = free
+    ReadyTraderGo::Side side = ReadyTraderGo::Side::BUY;
+    unsigned long price = 0;
+    unsigned long volume = 0;
+    unsigned long filled = 0;
+    signed long fees = 0;
+};
+
+enum class PaperEventType
+{
+    STATUS, FILL, HEDGE_FILL
+};
+
+//A message the paper exchange owes the trader
+struct PaperEvent
+{
+    PaperEventType type = PaperEventType::STATUS;
+    unsigned long id = 0;
+    unsigned long price = 0;        //FILL and HEDGE_FILL
+    unsigned long volume = 0;       //FILL and HEDGE_FILL, filled so far for STATUS
+    unsigned long remaining = 0;    //STATUS
+    signed long fees = 0;           //STATUS
+};
+
+//Local matching simulator the shadow trader's orders go to. Orders match against the exchange's books and trade ticks
+//as they arrive, without queue position or market impact. Replies are queued and handed over by deliver() so the
+//trader never gets one in the middle of sending.
+class PaperExchange
+{
+public:
+    PaperExchange();
+
+    void insert(unsigned long id, ReadyTraderGo::Side side, unsigned long price, unsigned long volume);
+
+    void amend(unsigned long id, unsigned long volume);
+
+    void cancel(unsigned long id);
+
+    void hedge(unsigned long id, ReadyTraderGo::Side side, unsigned long price, unsigned long volume);
+
+    void onMarket(const MarketMessage& message);
+
+    void deliver(TraderCore& trader);
+
+private:
+    PaperOrder* find(unsigned long id);
+
+    void fill(PaperOrder& order, unsigned long price, unsigned long volume, bool aggressive);
+
+    void status(const PaperOrder& order);
+
+    std::array<PaperOrder, PAPER_ORDERS> mOrders{};
+    std::vector<PaperEvent> mEvents;
+    std::vector<PaperEvent> mDelivering;
+    MarketMessage mEtfBook;
+    MarketMessage mFutureBook;
+};
+
+//Paper trades a second trader off a copy of the live feed. The trader is built by the factory on the shadow's own
+//thread (pinned to cpu if it is not -1) with its own io_context, and its orders go to a PaperExchange. The live side
+//only ever pushes into a ring and drops the message if the shadow has fallen behind.
+class ShadowTrader
+{
+public:
+    using Factory = TraderFactory;
+
+    explicit ShadowTrader(Factory factory, int cpu = -1);
+
+    ~ShadowTrader();
+
+    bool publish(const MarketMessage& message);
+
+    std::uint64_t dropped() const;
+
+private:
+    void run(Factory factory, int cpu);
+
+    SpscQueue<MarketMessage, SHADOW_QUEUE_SIZE> mQueue;
+    std::atomic<bool> mStop{false};
+    std::atomic<std::uint64_t> mDropped{0};
+    std::thread mThread;
+};
+
+//Appends a copy of the live feed to a journal file on its own thread, in the format replayJournal and the benchmarks
+//read. Like the shadow, the live side only ever pushes into a ring and drops the message if the writer has fallen
+//behind.
+class JournalRecorder
+{
+public:
+    explicit JournalRecorder(const std::string& fileName);
+
+    ~JournalRecorder();
+
+    bool publish(const MarketMessage& message);
+
+    std::uint64_t dropped() const;
+
+private:
+    void run(std::string fileName);
+
+    SpscQueue<MarketMessage, JOURNAL_QUEUE_SIZE> mQueue;
+    std::atomic<bool> mStop{false};
+    std::atomic<std::uint64_t> mDropped{0};
+    std::thread mThread;
+};
+
+unsigned long replayJournal(TraderCore& trader, const std::string& fileName);
+
+//Throughput and per message latency (ns) of one replayed session
+struct BenchmarkResult
+{
+    std::string session;
+    unsigned long messages = 0;
+    double messagesPerSecond = 0;
+    std::uint64_t p50 = 0;
+    std::uint64_t p99 = 0;
+    std::uint64_t p999 = 0;
+    std::uint64_t allocations = 0;
+};
+
+std::uint64_t heapAllocations();
+
+BenchmarkResult benchmarkJournal(TraderCore& trader, const std::string& fileName);
+
+bool runBenchmarkSuite(boost::asio::io_context& context, const std::vector<std::string>& sessions,
+                       const std::string& baselineFile, double tolerance);
+
+//Prices are in cents and volatilities are per book update of the instrument concerned
+struct GeneratorConfig
+{
+    double startPrice = 100000;
+    double volatility = 20;             //future random walk step
+    double spreadVolatility = 15;       //shock to the ETF-FUTURE spread
+    double spreadReversion = 0.05;      //fraction of the spread removed each ETF update
+    unsigned long halfSpreadTicks = 1;  //ticks from mid to the best bid/ask, at least 1
+    unsigned long depthVolume = 50;     //volume at the top level, level i holds about (i + 1) times this
+    double tradeProbability = 0.3;      //chance a book update is followed by trade ticks
+    double messagesPerSecond = 0;       //0 = as fast as possible
+    std::uint64_t seed = 1;
+};
+
+//Synthetic cointegrated FUTURE/ETF books and trade ticks for load testing, either driven straight into the
+//handlers of a trader that is not live or written out as a journal
+class MarketGenerator
+{
+public:
+    explicit MarketGenerator(const GeneratorConfig& config);
+
+    const MarketMessage& next();
+
+    void drive(TraderCore& trader, unsigned long count);
+
+    bool writeJournal(const std::string& fileName, unsigned long count);
+
+private:
+    void makeTrades(std::uniform_real_distribution<double>& uniform);
+
+    GeneratorConfig mConfig;
+    std::mt19937_64 mRandom;
+    double mFuture;
+    double mSpread = 0;
+    bool mEtfNext = true;
+    bool mTradesPending = false;
+    std::array<std::uint64_t, 2> mSequence{};
+    MarketMessage mMessage;
 };
 
 
@@ -0,0 +1,114 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <boost/asio/io_context.hpp>
+
+#include "autotrader.h"
+
+constexpr double DEFAULT_TOLERANCE = 0.1;
+constexpr const char* SESSIONS_FILE = "sessions.txt";
+constexpr const char* BASELINES_FILE = "baselines.txt";
+
+//Replay regression suite (see run_benchmarks.sh), must be built with AUTOTRADER_COUNT_ALLOCATIONS defined for
+//autotrader.cc as well so heap allocations are counted.
+//
+//  benchmark [--tolerance FRACTION] DIRECTORY
+//
+//DIRECTORY holds sessions.txt and baselines.txt. Each line of sessions.txt is either a recorded journal file or a
+//synthetic session, "file messages seed volatility tradeProbability", generated with that seed the first time it is
+//missing so every run replays the same messages. Exits non-zero on any regression.
+int main(int argc, char* argv[])
+{
+    double tolerance = DEFAULT_TOLERANCE;
+    const char* directory = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+        {
+            tolerance = std::strtod(argv[++i], nullptr);
+        }
+        else
+        {
+            directory = argv[i];
+        }
+    }
+    if (directory == nullptr || ::chdir(directory) != 0)
+    {
+        std::fprintf(stderr, "usage: %s [--tolerance FRACTION] DIRECTORY\n", argv[0]);
+        return 2;
+    }
+
+    //a plain build would read 0 allocations everywhere and never catch one
+    std::uint64_t before = heapAllocations();
+    void* probe = ::operator new(1); //a new expression could be optimised away, a call to operator new cannot
+    bool counting = heapAllocations() != before;
+    ::operator delete(probe);
+    if (!counting)
+    {
+        std::fprintf(stderr, "benchmark: built without AUTOTRADER_COUNT_ALLOCATIONS, allocations cannot be checked\n");
+        return 2;
+    }
+
+    std::vector<std::string> sessions;
+    std::ifstream list(SESSIONS_FILE);
+    std::string line;
+    while (std::getline(list, line))
+    {
+        std::istringstream fields(line);
+        std::string file;
+        if (!(fields >> file) || file[0] == '#')
+        {
+            continue;
+        }
+        GeneratorConfig config;
+        unsigned long messages = 0;
+        if (fields >> messages >> config.seed >> config.volatility >> config.tradeProbability
+            && !std::ifstream(file))
+        {
+            std::printf("benchmark: generating %s, %lu messages with seed %lu\n", file.c_str(), messages,
+                        (unsigned long)config.seed);
+            if (!MarketGenerator(config).writeJournal(file, messages))
+            {
+                std::fprintf(stderr, "benchmark: could not write %s\n", file.c_str());
+                return 2;
+            }
+        }
+        sessions.push_back(file);
+    }
+    if (sessions.empty())
+    {
+        std::fprintf(stderr, "benchmark: no sessions in %s/%s\n", directory, SESSIONS_FILE);
+        return 2;
+    }
+
+    boost::asio::io_context context;
+    bool passed = runBenchmarkSuite(context, sessions, BASELINES_FILE, tolerance);
+    std::printf("benchmark: %s, %zu sessions at %.0f%% tolerance\n", passed ? "passed" : "REGRESSION",
+                sessions.size(), tolerance * 100);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#!/usr/bin/env bash
+#
+# Profile-guided, link-time optimised build of the autotrader.
+#
+#   tools/pgo_build.sh PROJECT_DIR [JOURNAL...]
+#
+# PROJECT_DIR is the Ready Trader Go C++ project (the directory with its CMakeLists.txt, main.cc and libs/).
+# The journals are sessions recorded by a live trader built with ENABLE_JOURNAL on, with none given the training run
+# uses a synthetic session instead.
+#
+#   1. configure and build the autotrader with -fprofile-generate
+#   2. link tools/replay.cc against that same autotrader.cc object and replay the journals through it
+#   3. reconfigure the same build directory with -fprofile-use -flto and rebuild
+#
+# Both builds share one build directory so the profile files line up with the object files that wrote them (GCC
+# names them after the object's path). Environment overrides:
+#   BUILD_DIR         build directory, default PROJECT_DIR/build-pgo
+#   PROFILE_DIR       where the profile is written, default BUILD_DIR/profile
+#   CXX               compiler, default g++
+#   BOOST_LIBS        Boost libraries the project links, default the log/thread/system set
+#   SYNTHETIC_COUNT   messages in the synthetic session, default 2000000
+
+set -euo pipefail
+
+if [[ $# -lt 1 ]]; then
+    echo "usage: $0 PROJECT_DIR [JOURNAL...]" >&2
+    exit 1
+fi
+
+TOOLS_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+PROJECT_DIR="$(cd "$1" && pwd)"
+shift
+BUILD_DIR="${BUILD_DIR:-$PROJECT_DIR/build-pgo}"
+PROFILE_DIR="${PROFILE_DIR:-$BUILD_DIR/profile}"
+CXX="${CXX:-g++}"
+BOOST_LIBS="${BOOST_LIBS:--lboost_log_setup -lboost_log -lboost_thread -lboost_filesystem -lboost_system}"
+SYNTHETIC_COUNT="${SYNTHETIC_COUNT:-2000000}"
+
+#the training run happens inside the build directory, so journals are made absolute first
+JOURNALS=()
+for journal in "$@"; do
+    JOURNALS+=("$(cd "$(dirname "$journal")" && pwd)/$(basename "$journal")")
+done
+
+GENERATE_FLAGS="-fprofile-generate -fprofile-update=atomic -fprofile-dir=$PROFILE_DIR"
+#main.cc and the library never run during training, so they have no profile to miss
+USE_FLAGS="-fprofile-use -fprofile-correction -fprofile-dir=$PROFILE_DIR -Wno-missing-profile -flto"
+
+echo "== instrumented build"
+rm -rf "$PROFILE_DIR"
+cmake -S "$PROJECT_DIR" -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release -DCMAKE_CXX_COMPILER="$CXX" \
+      -DCMAKE_CXX_FLAGS="$GENERATE_FLAGS" -DCMAKE_EXE_LINKER_FLAGS="$GENERATE_FLAGS" \
+      -DCMAKE_INTERPROCEDURAL_OPTIMIZATION=OFF
+cmake --build "$BUILD_DIR" --target autotrader -j"$(nproc)"
+
+AUTOTRADER_OBJECT="$(find "$BUILD_DIR" -path '*autotrader.dir*' -name 'autotrader.cc.o' | head -n 1)"
+READY_TRADER_GO_LIB="$(find "$BUILD_DIR" -name 'libready_trader_go.a' | head -n 1)"
+if [[ -z "$AUTOTRADER_OBJECT" || -z "$READY_TRADER_GO_LIB" ]]; then
+    echo "could not find autotrader.cc.o and libready_trader_go.a under $BUILD_DIR" >&2
+    exit 1
+fi
+
+echo "== training run"
+"$CXX" -std=c++17 -O3 $GENERATE_FLAGS -I"$PROJECT_DIR" -I"$PROJECT_DIR/libs" "$TOOLS_DIR/replay.cc" \
+       "$AUTOTRADER_OBJECT" "$READY_TRADER_GO_LIB" $BOOST_LIBS -pthread -o "$BUILD_DIR/replay"
+(
+    #the trader writes its flight dumps next to wherever it runs
+    cd "$BUILD_DIR"
+    if [[ ${#JOURNALS[@]} -gt 0 ]]; then
+        ./replay "${JOURNALS[@]}"
+    else
+        ./replay --synthetic "$SYNTHETIC_COUNT"
+    fi
+)
+
+echo "== optimised build"
+cmake -S "$PROJECT_DIR" -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release -DCMAKE_CXX_COMPILER="$CXX" \
+      -DCMAKE_CXX_FLAGS="$USE_FLAGS" -DCMAKE_EXE_LINKER_FLAGS="-flto" \
+      -DCMAKE_INTERPROCEDURAL_OPTIMIZATION=ON
+cmake --build "$BUILD_DIR" --target autotrader -j"$(nproc)" --clean-first
+
+echo "== done: $BUILD_DIR/autotrader"
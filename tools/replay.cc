@@ -0,0 +1,60 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <boost/asio/io_context.hpp>
+
+#include "autotrader.h"
+
+//Training run for profile-guided builds (see pgo_build.sh): replays recorded sessions, or a synthetic one, through
+//a BENCHMARK AutoTrader so the profile covers the same handlers, branches and ladder code the live binary runs.
+//
+//  replay [--synthetic COUNT] JOURNAL...
+//
+//Journals are recorded by a live trader built with ENABLE_JOURNAL on. Exits non-zero if nothing was replayed.
+int main(int argc, char* argv[])
+{
+    boost::asio::io_context context;
+    unsigned long total = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        AutoTrader trader(context, {}, LossLimitRisk(), BatchedHedging(), TraderMode::BENCHMARK);
+        if (std::strcmp(argv[i], "--synthetic") == 0 && i + 1 < argc)
+        {
+            unsigned long count = std::strtoul(argv[++i], nullptr, 10);
+            MarketGenerator(GeneratorConfig()).drive(trader, count);
+            std::printf("replay: %lu synthetic messages\n", count);
+            total += count;
+            continue;
+        }
+        unsigned long count = replayJournal(trader, argv[i]);
+        std::printf("replay: %lu messages from %s\n", count, argv[i]);
+        total += count;
+    }
+
+    if (total == 0)
+    {
+        std::fprintf(stderr, "usage: %s [--synthetic COUNT] JOURNAL...\n", argv[0]);
+        return 1;
+    }
+    return 0;
+}
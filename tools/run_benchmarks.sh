@@ -0,0 +1,44 @@
+#!/usr/bin/env bash
+#
+# Replay regression suite: builds tools/benchmark with allocation counting and runs it over benchmarks/.
+#
+#   tools/run_benchmarks.sh PROJECT_DIR [TOLERANCE]
+#
+# PROJECT_DIR is the Ready Trader Go C++ project (the directory with its CMakeLists.txt, main.cc and libs/), only its
+# ready_trader_go library is built from it. TOLERANCE is a fraction, default 0.1. Exits non-zero on any regression.
+# Environment overrides:
+#   BUILD_DIR         build directory, default PROJECT_DIR/build-benchmark
+#   CXX               compiler, default g++
+#   CXXFLAGS          optimisation flags, default -O3 (use the live build's, e.g. the PGO ones, to benchmark those)
+#   BOOST_LIBS        Boost libraries the project links, default the log/thread/system set
+
+set -euo pipefail
+
+if [[ $# -lt 1 ]]; then
+    echo "usage: $0 PROJECT_DIR [TOLERANCE]" >&2
+    exit 2
+fi
+
+TOOLS_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+SOURCE_DIR="$(dirname "$TOOLS_DIR")"
+PROJECT_DIR="$(cd "$1" && pwd)"
+TOLERANCE="${2:-0.1}"
+BUILD_DIR="${BUILD_DIR:-$PROJECT_DIR/build-benchmark}"
+CXX="${CXX:-g++}"
+CXXFLAGS="${CXXFLAGS:--O3}"
+BOOST_LIBS="${BOOST_LIBS:--lboost_log_setup -lboost_log -lboost_thread -lboost_filesystem -lboost_system}"
+
+cmake -S "$PROJECT_DIR" -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release -DCMAKE_CXX_COMPILER="$CXX"
+cmake --build "$BUILD_DIR" --target ready_trader_go -j"$(nproc)"
+READY_TRADER_GO_LIB="$(find "$BUILD_DIR" -name 'libready_trader_go.a' | head -n 1)"
+if [[ -z "$READY_TRADER_GO_LIB" ]]; then
+    echo "could not find libready_trader_go.a under $BUILD_DIR" >&2
+    exit 2
+fi
+
+#the counting operator new lives in autotrader.cc, so it has to be built with the macro as well
+"$CXX" -std=c++17 $CXXFLAGS -DAUTOTRADER_COUNT_ALLOCATIONS -I"$SOURCE_DIR" -I"$PROJECT_DIR/libs" \
+       "$TOOLS_DIR/benchmark.cc" "$SOURCE_DIR/autotrader.cc" "$READY_TRADER_GO_LIB" $BOOST_LIBS -pthread \
+       -o "$BUILD_DIR/benchmark"
+
+"$BUILD_DIR/benchmark" --tolerance "$TOLERANCE" "$SOURCE_DIR/benchmarks"